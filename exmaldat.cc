@@ -23,14 +23,24 @@
 #include <signal.h>
 #include <iostream>
 #include <fstream>
+#include <iomanip>
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <algorithm>
 #include "mlib/reader.h"
 #include "mlib/extractor.h"
+#include "mlib/stats.h"
 
 void print_usage() {
-  std::cout << "Usage: exmaldat <product-name> [-dfmwstv] <input-file> [-p internal-path]\n"
-            << "       [output-directory]\n\n"
+  std::cout << "Usage: exmaldat <product-name> [-adfimwstv] <input-file> [-p internal-path]\n"
+            << "       [-c cache-directory] [output-directory]\n\n"
             << "  d  : decrypt an archive, not extract. other options are ignored.\n"
             << "       (default: disable)\n"
+            << "  i  : write an index of an archive (input-file.mlidx) to open it faster,\n"
+            << "       not extract. other options are ignored. (default: disable)\n"
             << "  f  : flatten directory structure (default: disable)\n"
             << "  m  : convert mgf into png (default: enable)\n"
             << "  w  : convert webp into png (default: enable on and after SGB)\n"
@@ -40,6 +50,16 @@ void print_usage() {
             << "  t1 : as for -t, but extract level 1 textures only (default: disable)\n"
             << "  t2 : as for -t, but extract level 2 textures only (default: disable)\n"
             << "  v  : verbose (default: disable)\n"
+            << "  jN : decrypt with N threads (default: the number of CPUs)\n"
+            << "  a  : read and write files asynchronously (default: disable)\n"
+            << "  aN : as for -a, but keep up to N requests in flight (default: 64)\n"
+            << "  -c : keep decrypted copies of archives in cache-directory\n"
+            << "       (default: $MLIB_CACHE_DIR if set, and disable otherwise)\n"
+            << "  --stats[=json] : print I/O statistics to stderr at exit\n\n"
+            << "       exmaldat --list-keys\n"
+            << "       exmaldat --detect <input-file>\n\n"
+            << "  --list-keys : print the products in key_info.csv\n"
+            << "  --detect    : print the products whose key decodes input-file\n"
             << std::endl;
 }
 
@@ -48,17 +68,22 @@ struct Parameters {
   std::string lib_name;
   std::string internal_path;
   std::string output_directory;
+  std::string cache_directory;
   bool verbose;
   bool decrypt;
+  bool write_index;
   bool flatten;
   bool mgf2png;
   bool webp2png;
   bool skip_svg;
   bool texcat;
   int tex_level;
+  unsigned int jobs;
+  bool async_io;
+  unsigned int queue_depth;
   Parameters()
-    : verbose(false), decrypt(false), flatten(false), mgf2png(true), webp2png(true),
-      skip_svg(false), texcat(true), tex_level(0) {}
+    : verbose(false), decrypt(false), write_index(false), flatten(false), mgf2png(true), webp2png(true),
+      skip_svg(false), texcat(true), tex_level(0), jobs(0), async_io(false), queue_depth(0) {}
 };
 
 bool get_param(int argc, char **argv, Parameters *params) {
@@ -68,6 +93,9 @@ bool get_param(int argc, char **argv, Parameters *params) {
     std::string p = argv[i];
     std::string::iterator it = p.begin();
     const std::string::const_iterator it_end = p.end();
+    if (mlib::Stats::GetInstance().ParseOption(p)) {
+      continue;
+    }
     if (p == "-p") {
       if (argc <= i + 1) {
         std::cerr << "ERROR: invalid parameter 'p'." << std::endl;
@@ -77,6 +105,15 @@ bool get_param(int argc, char **argv, Parameters *params) {
       params->internal_path.assign(argv[i]);
       continue;
     }
+    if (p == "-c") {
+      if (argc <= i + 1) {
+        std::cerr << "ERROR: invalid parameter 'c'." << std::endl;
+        return false;
+      }
+      ++i;
+      params->cache_directory.assign(argv[i]);
+      continue;
+    }
     if (*it == '-') {
       for (++it; it != it_end; ++it) {
         switch (*it) {
@@ -89,6 +126,9 @@ bool get_param(int argc, char **argv, Parameters *params) {
         case 'D':
           params->decrypt = false;
           break;
+        case 'i':
+          params->write_index = true;
+          break;
         case 'f':
           params->flatten = true;
           break;
@@ -136,6 +176,30 @@ bool get_param(int argc, char **argv, Parameters *params) {
         case 'T':
           params->texcat = false;
           break;
+        case 'j': {
+            unsigned int jobs = 0;
+            for (; it + 1 != it_end && std::isdigit(*(it + 1)); ++it) {
+              jobs = jobs * 10 + (*(it + 1) - '0');
+            }
+            if (jobs == 0) {
+              std::cerr << "ERROR: invalid parameter 'j'." << std::endl;
+              return false;
+            }
+            params->jobs = jobs;
+          }
+          break;
+        case 'a': {
+            unsigned int depth = 0;
+            for (; it + 1 != it_end && std::isdigit(*(it + 1)); ++it) {
+              depth = depth * 10 + (*(it + 1) - '0');
+            }
+            params->async_io = true;
+            params->queue_depth = depth;
+          }
+          break;
+        case 'A':
+          params->async_io = false;
+          break;
         default:
           std::cerr << "ERROR: invalid parameter '" << *it << "'." << std::endl;
           return false;
@@ -153,10 +217,14 @@ bool get_param(int argc, char **argv, Parameters *params) {
   return true;
 }
 
-bool decrypt(const std::string &product, const std::string& path) {
-  // create reader
-  mlib::Reader *reader = mlib::CreateReader(path, product);
+bool decrypt(const std::string &product, const std::string& path, unsigned int jobs) {
+  // both ciphers are addressable per 16-byte block, so the archive is
+  // decrypted in independent chunks which are written with pwrite(2).
+  static const size_t kChunkSize = 4 * 1024 * 1024;
+  // create reader (shared by the workers since its reads are positional)
+  std::unique_ptr<mlib::Reader> reader(mlib::CreateReader(path, product));
   if (reader == nullptr) return false;
+  const size_t size = reader->GetSize();
   // specify output file name
   size_t ext_pos = path.find_last_of('.');
   std::string decrypted_filename(path.substr(0, ext_pos));
@@ -164,22 +232,88 @@ bool decrypt(const std::string &product, const std::string& path) {
   if (ext_pos != std::string::npos) {
     decrypted_filename.append(path.substr(ext_pos));
   }
+  // preallocate the decrypted MLib
+  int fd = ::open(decrypted_filename.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (fd == -1) {
+    std::cerr << "ERROR: failed to create '" << decrypted_filename << "'." << std::endl;
+    return false;
+  }
+  if (::posix_fallocate(fd, 0, size) != 0 && ::ftruncate(fd, size) != 0) {
+    std::cerr << "ERROR: failed to allocate '" << decrypted_filename << "'." << std::endl;
+    ::close(fd);
+    return false;
+  }
   // decrypt MLib and write decrypted MLib
-  const size_t size = reader->GetSize();
-  char *buf = new char[65536];
-  std::ofstream ofs(decrypted_filename);
-  for (size_t i = 0; i < size; i += 65536) {
-    size_t read_size = 65536;
-    if (size - i < 65536) {
-      read_size = size - i;
+  const size_t chunk_count = (size + kChunkSize - 1) / kChunkSize;
+  if (jobs == 0) {
+    jobs = std::max(1U, std::thread::hardware_concurrency());
+  }
+  jobs = std::min(jobs, static_cast<unsigned int>(std::max<size_t>(1, chunk_count)));
+  std::atomic<size_t> next_chunk(0);
+  std::atomic<size_t> done_bytes(0);
+  std::atomic<bool> failed(false);
+  auto worker = [&]() {
+    std::vector<char> buf(kChunkSize);
+    for (size_t i = next_chunk++; i < chunk_count && !failed; i = next_chunk++) {
+      const off_t offset = static_cast<off_t>(i * kChunkSize);
+      const size_t read_size = std::min(kChunkSize, size - i * kChunkSize);
+      if (reader->Read(offset, read_size, &buf[0]) != read_size) {
+        failed = true;
+        break;
+      }
+      for (size_t written = 0; written < read_size; ) {
+        const auto ret = ::pwrite(fd, &buf[written], read_size - written, offset + written);
+        if (ret <= 0) {
+          failed = true;
+          break;
+        }
+        written += ret;
+      }
+      done_bytes += read_size;
+    }
+  };
+  std::vector<std::thread> workers;
+  for (unsigned int i = 0; i < jobs; ++i) {
+    workers.emplace_back(worker);
+  }
+  // report progress
+  std::cout << "-- Decrypting '" << path << "' with " << jobs << " thread(s)...";
+  std::cout.flush();
+  int last_percent = -1;
+  while (done_bytes < size && !failed) {
+    const int percent = static_cast<int>(100.0 * done_bytes / size);
+    if (percent != last_percent) {
+      std::cout << "\r-- Decrypting '" << path << "' with " << jobs
+                << " thread(s)... " << percent << '%';
+      std::cout.flush();
+      last_percent = percent;
     }
-    reader->Read(i, read_size, buf);
-    ofs.write(buf, read_size);
-    if (size - i <= 65536) break;
+    std::this_thread::sleep_for(std::chrono::milliseconds(200));
+  }
+  for (auto &t : workers) {
+    t.join();
+  }
+  ::close(fd);
+  if (failed) {
+    std::cout << std::endl;
+    return false;
+  }
+  std::cout << "\r-- Decrypting '" << path << "' with " << jobs << " thread(s)... ";
+  return true;
+}
+
+bool detect(const std::string &path) {
+  const std::vector<mlib::ProductCandidate> candidates = mlib::DetectProduct(path);
+  if (candidates.empty()) {
+    std::cerr << "ERROR: no product matches '" << path << "'." << std::endl;
+    return false;
+  }
+  std::cout << " PRODUCT  FORMAT  SCORE" << std::endl
+            << "-------- ------- -------" << std::endl;
+  for (const auto &c : candidates) {
+    std::cout << ' ' << std::setw(8) << std::left << c.product
+              << std::setw(8) << c.format << c.score << std::endl;
   }
-  ofs.close();
-  delete [] buf;
-  delete reader;
   return true;
 }
 
@@ -217,16 +351,30 @@ int main(int argc, char **argv) {
     mlib::PrintKeyInfo();
     return 0;
   }
+  if (params.product_name == "--detect") {
+    return detect(params.lib_name) ? 0 : -1;
+  }
+  if ( !params.cache_directory.empty() ) {
+    mlib::SetShadowCacheDirectory(params.cache_directory);
+  }
+
+  if (params.write_index == true) {
+    if (mlib::WriteIndex(params.lib_name, params.product_name) == false) {
+      std::cerr << "ERROR: failed to write the index of '" << params.lib_name << "'." << std::endl;
+      return -1;
+    }
+    std::cout << "OK." << std::endl;
+    return 0;
+  }
 
   if (params.decrypt == true) {
-    std::cout << "-- Decrypting '" << params.lib_name << "'...";
-    std::cout.flush();
-    bool ret = decrypt(params.product_name, params.lib_name);
+    bool ret = decrypt(params.product_name, params.lib_name, params.jobs);
     if (ret == false) {
       std::cerr << "ERROR: failed to decrypt '" << params.lib_name << "'." << std::endl;
       return -1;
     }
     std::cout << "OK." << std::endl;
+    mlib::Stats::GetInstance().Report();
     return 0;
   }
 
@@ -248,12 +396,17 @@ int main(int argc, char **argv) {
   extractor.EnableSVG(!params.skip_svg);
   extractor.EnableTexCat(params.texcat);
   extractor.SetTexLevel(params.tex_level);
+  extractor.EnableAsyncIO(params.async_io);
+  if (params.queue_depth != 0) {
+    extractor.SetQueueDepth(params.queue_depth);
+  }
 
   ::signal(SIGINT, &signal_handler);
   extractor.Extract(p_entry, params.output_directory);
 
   delete p_entry;
   mlib::Extractor::Finalize();
+  mlib::Stats::GetInstance().Report();
 
   return 0;
 }
@@ -0,0 +1,128 @@
+/* block_cache.cc (updated on 2018/05/06)
+ * Copyright (C) 2018 renny1398.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ */
+
+#include <cstring>
+#include <algorithm>
+#include <iterator>
+#include "block_cache.h"
+#include "fnv1a.h"
+
+namespace mlib {
+
+const size_t BlockCache::kBlockSize;
+const size_t BlockCache::kDefaultCapacity;
+
+BlockCache::BlockCache()
+  : capacity_(0), hits_(0), misses_(0) {
+  SetCapacity(kDefaultCapacity);
+}
+
+BlockCache &BlockCache::GetInstance() {
+  static BlockCache instance;
+  return instance;
+}
+
+BlockCache::FileIdentityPtr BlockCache::MakeFileIdentity(const struct stat &st,
+                                                         const void *tag, size_t tag_length) {
+  std::shared_ptr<FileIdentity> file(new FileIdentity());
+  file->dev = st.st_dev;
+  file->ino = st.st_ino;
+  file->size = st.st_size;
+  file->mtime_sec = st.st_mtim.tv_sec;
+  file->mtime_nsec = st.st_mtim.tv_nsec;
+  file->ctime_sec = st.st_ctim.tv_sec;
+  file->ctime_nsec = st.st_ctim.tv_nsec;
+  file->tag.assign(static_cast<const char *>(tag), tag_length);
+  uint64_t h = kFnv1aOffsetBasis;
+  h = Fnv1a(h, &file->dev, sizeof(file->dev));
+  h = Fnv1a(h, &file->ino, sizeof(file->ino));
+  h = Fnv1a(h, &file->size, sizeof(file->size));
+  h = Fnv1a(h, &file->mtime_sec, sizeof(file->mtime_sec));
+  h = Fnv1a(h, &file->mtime_nsec, sizeof(file->mtime_nsec));
+  h = Fnv1a(h, &file->ctime_sec, sizeof(file->ctime_sec));
+  h = Fnv1a(h, &file->ctime_nsec, sizeof(file->ctime_nsec));
+  file->hash = Fnv1a(h, tag, tag_length);
+  return file;
+}
+
+void BlockCache::SetCapacity(size_t bytes) {
+  capacity_ = bytes;
+  const size_t blocks_per_shard = bytes / kBlockSize / kShardCount;
+  for (auto &shard : shards_) {
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    shard.capacity = blocks_per_shard;
+    while (shard.lru.size() > shard.capacity) {
+      shard.map.erase(shard.lru.back().key);
+      shard.lru.pop_back();
+    }
+  }
+}
+
+size_t BlockCache::Lookup(const FileIdentityPtr &file, uint64_t block_index, char *dest) {
+  const Key key = { file->hash, block_index };
+  Shard &shard = GetShard(key);
+  std::lock_guard<std::mutex> lock(shard.mutex);
+  const auto it = shard.map.find(key);
+  if (it == shard.map.end() ||
+      (it->second->file != file && !(*it->second->file == *file))) {
+    ++misses_;
+    return 0;
+  }
+  ++hits_;
+  shard.lru.splice(shard.lru.begin(), shard.lru, it->second);
+  const Block &block = *it->second;
+  ::memcpy(dest, block.data, block.length);
+  return block.length;
+}
+
+void BlockCache::Insert(const FileIdentityPtr &file, uint64_t block_index,
+                        const char *src, size_t length) {
+  const Key key = { file->hash, block_index };
+  Shard &shard = GetShard(key);
+  std::lock_guard<std::mutex> lock(shard.mutex);
+  if (shard.capacity == 0) return;
+  length = std::min(length, kBlockSize);
+  auto it = shard.map.find(key);
+  if (it != shard.map.end()) {
+    shard.lru.splice(shard.lru.begin(), shard.lru, it->second);
+  } else {
+    if (shard.lru.size() >= shard.capacity) {
+      // reuse the least recently used block
+      shard.map.erase(shard.lru.back().key);
+      shard.lru.splice(shard.lru.begin(), shard.lru, std::prev(shard.lru.end()));
+    } else {
+      shard.lru.emplace_front();
+    }
+    shard.lru.front().key = key;
+    shard.map[key] = shard.lru.begin();
+  }
+  Block &block = shard.lru.front();
+  block.file = file;
+  ::memcpy(block.data, src, length);
+  block.length = length;
+}
+
+void BlockCache::Clear() {
+  for (auto &shard : shards_) {
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    shard.map.clear();
+    shard.lru.clear();
+  }
+}
+
+} // namespace mlib
@@ -0,0 +1,147 @@
+#pragma once
+
+/* block_cache.h (updated on 2018/05/06)
+ * Copyright (C) 2018 renny1398.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ */
+
+#include <stdint.h>
+#include <stddef.h>
+#include <sys/stat.h>
+#include <atomic>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+namespace mlib {
+
+////////////////////////////////////////////////////////////////////////
+/// @brief A process-wide LRU cache of decoded file blocks
+///        shared by all readers.
+////////////////////////////////////////////////////////////////////////
+
+class BlockCache {
+public:
+  static const size_t kBlockSize = 4096;
+  static const size_t kDefaultCapacity = 64 * 1024 * 1024;
+
+  /**
+   * @brief Returns the process-wide cache.
+   */
+  static BlockCache &GetInstance();
+
+  /**
+   * @brief The identity of a decoded file. A cached block is served only
+   *        to a file with an equal identity, so a file rewritten in place
+   *        never gets the blocks of its old contents.
+   */
+  struct FileIdentity {
+    uint64_t dev;
+    uint64_t ino;
+    uint64_t size;
+    int64_t mtime_sec;
+    int64_t mtime_nsec;
+    int64_t ctime_sec;
+    int64_t ctime_nsec;
+    std::string tag;  // bytes which identify how the file is decoded (e.g. a cipher type and a key)
+    uint64_t hash;    // a hash of the above, which only places blocks in the cache
+
+    bool operator==(const FileIdentity &rhs) const {
+      return dev == rhs.dev && ino == rhs.ino && size == rhs.size &&
+             mtime_sec == rhs.mtime_sec && mtime_nsec == rhs.mtime_nsec &&
+             ctime_sec == rhs.ctime_sec && ctime_nsec == rhs.ctime_nsec &&
+             tag == rhs.tag;
+    }
+  };
+  typedef std::shared_ptr<const FileIdentity> FileIdentityPtr;
+
+  /**
+   * @brief Generate a file identity for cache keys.
+   * @param[in] st the status of the file.
+   * @param[in] tag bytes which identify how the file is decoded.
+   * @param[in] tag_length the length of the tag.
+   */
+  static FileIdentityPtr MakeFileIdentity(const struct stat &st, const void *tag, size_t tag_length);
+
+  /**
+   * @brief Set the memory budget. 0 disables the cache.
+   */
+  void SetCapacity(size_t bytes);
+  size_t GetCapacity() const { return capacity_; }
+
+  /**
+   * @brief Copy a cached block into dest (kBlockSize bytes at most).
+   * @return the length of the cached block if found, and 0 otherwise.
+   */
+  size_t Lookup(const FileIdentityPtr &file, uint64_t block_index, char *dest);
+
+  /**
+   * @brief Store a decoded block.
+   */
+  void Insert(const FileIdentityPtr &file, uint64_t block_index, const char *src, size_t length);
+
+  void Clear();
+
+  uint64_t GetHitCount() const { return hits_; }
+  uint64_t GetMissCount() const { return misses_; }
+
+private:
+  BlockCache();
+  BlockCache(const BlockCache &) = delete;
+  BlockCache &operator=(const BlockCache &) = delete;
+
+  // files whose identities have the same hash share keys, and then
+  // Block::file tells them apart
+  struct Key {
+    uint64_t file_hash;
+    uint64_t block_index;
+    bool operator==(const Key &k) const {
+      return file_hash == k.file_hash && block_index == k.block_index;
+    }
+  };
+  struct KeyHash {
+    size_t operator()(const Key &k) const {
+      return static_cast<size_t>(k.file_hash ^ (k.block_index * 0x9e3779b97f4a7c15ULL));
+    }
+  };
+  struct Block {
+    Key key;
+    FileIdentityPtr file;
+    size_t length;
+    char data[kBlockSize];
+  };
+  // the cache is split into shards to reduce lock contention
+  struct Shard {
+    std::mutex mutex;
+    std::list<Block> lru;  // the front is the most recently used
+    std::unordered_map<Key, std::list<Block>::iterator, KeyHash> map;
+    size_t capacity;       // in blocks
+  };
+  static const unsigned int kShardCount = 16;
+
+  Shard &GetShard(const Key &key) {
+    return shards_[KeyHash()(key) % kShardCount];
+  }
+
+  Shard shards_[kShardCount];
+  std::atomic<size_t> capacity_;
+  std::atomic<uint64_t> hits_;
+  std::atomic<uint64_t> misses_;
+};
+
+} // namespace mlib
@@ -1459,3 +1459,207 @@ void Camellia_DecryptBlock(const int keyBitLength,
     PUTU32(plaintext + 8, tmp[2]);
     PUTU32(plaintext + 12, tmp[3]);
 }
+
+
+/*
+ * multi-block decryption
+ *
+ * The AVX2 kernel keeps one word of eight blocks in each ymm register
+ * and performs the S-box lookups with gathers from the same tables as
+ * the scalar code, so both paths share a single definition of Camellia.
+ */
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define CAMELLIA_HAVE_AVX2 1
+#include <immintrin.h>
+#endif
+
+#ifdef CAMELLIA_HAVE_AVX2
+
+#define CAMELLIA_AVX2 __attribute__((target("avx2")))
+
+#define CAMELLIA_V_SP(TABLE, IDX)					\
+    _mm256_i32gather_epi32((const int *)(TABLE), (IDX), 4)
+
+#define CAMELLIA_V_BYTE(x, SHIFT)					\
+    _mm256_and_si256(_mm256_srli_epi32((x), (SHIFT)), mask_ff)
+
+#define CAMELLIA_V_RR8(x)						\
+    _mm256_or_si256(_mm256_srli_epi32((x), 8), _mm256_slli_epi32((x), 24))
+
+#define CAMELLIA_V_RL1(x)						\
+    _mm256_or_si256(_mm256_slli_epi32((x), 1), _mm256_srli_epi32((x), 31))
+
+#define CAMELLIA_V_ROUNDSM(xl, xr, INDEX, yl, yr)			\
+    do {								\
+	__m256i il_, ir_;						\
+	ir_ = _mm256_xor_si256(						\
+	    _mm256_xor_si256(						\
+		CAMELLIA_V_SP(camellia_sp1110, _mm256_and_si256(xr, mask_ff)), \
+		CAMELLIA_V_SP(camellia_sp0222, _mm256_srli_epi32(xr, 24))), \
+	    _mm256_xor_si256(						\
+		CAMELLIA_V_SP(camellia_sp3033, CAMELLIA_V_BYTE(xr, 16)), \
+		CAMELLIA_V_SP(camellia_sp4404, CAMELLIA_V_BYTE(xr, 8)))); \
+	il_ = _mm256_xor_si256(						\
+	    _mm256_xor_si256(						\
+		CAMELLIA_V_SP(camellia_sp1110, _mm256_srli_epi32(xl, 24)), \
+		CAMELLIA_V_SP(camellia_sp0222, CAMELLIA_V_BYTE(xl, 16))), \
+	    _mm256_xor_si256(						\
+		CAMELLIA_V_SP(camellia_sp3033, CAMELLIA_V_BYTE(xl, 8)),	\
+		CAMELLIA_V_SP(camellia_sp4404, _mm256_and_si256(xl, mask_ff)))); \
+	il_ = _mm256_xor_si256(il_,					\
+			       _mm256_set1_epi32((int)CamelliaSubkeyL(INDEX))); \
+	ir_ = _mm256_xor_si256(ir_,					\
+			       _mm256_set1_epi32((int)CamelliaSubkeyR(INDEX))); \
+	ir_ = _mm256_xor_si256(ir_, il_);				\
+	il_ = _mm256_xor_si256(CAMELLIA_V_RR8(il_), ir_);		\
+	yl = _mm256_xor_si256(yl, ir_);					\
+	yr = _mm256_xor_si256(yr, il_);					\
+    } while(0)
+
+#define CAMELLIA_V_FLS(ll, lr, rl, rr, KINDEX, KRINDEX)		\
+    do {								\
+	__m256i t_;							\
+	t_ = _mm256_and_si256(ll,					\
+			      _mm256_set1_epi32((int)CamelliaSubkeyL(KINDEX))); \
+	lr = _mm256_xor_si256(lr, CAMELLIA_V_RL1(t_));			\
+	t_ = _mm256_or_si256(lr,					\
+			     _mm256_set1_epi32((int)CamelliaSubkeyR(KINDEX))); \
+	ll = _mm256_xor_si256(ll, t_);					\
+	t_ = _mm256_or_si256(rr,					\
+			     _mm256_set1_epi32((int)CamelliaSubkeyR(KRINDEX))); \
+	rl = _mm256_xor_si256(rl, t_);					\
+	t_ = _mm256_and_si256(rl,					\
+			      _mm256_set1_epi32((int)CamelliaSubkeyL(KRINDEX))); \
+	rr = _mm256_xor_si256(rr, CAMELLIA_V_RL1(t_));			\
+    } while(0)
+
+/* 4x4 transpose of 32-bit words within each 128-bit lane */
+#define CAMELLIA_V_TRANSPOSE(a, b, c, d)				\
+    do {								\
+	__m256i t0_ = _mm256_unpacklo_epi32(a, b);			\
+	__m256i t1_ = _mm256_unpackhi_epi32(a, b);			\
+	__m256i t2_ = _mm256_unpacklo_epi32(c, d);			\
+	__m256i t3_ = _mm256_unpackhi_epi32(c, d);			\
+	a = _mm256_unpacklo_epi64(t0_, t2_);				\
+	b = _mm256_unpackhi_epi64(t0_, t2_);				\
+	c = _mm256_unpacklo_epi64(t1_, t3_);				\
+	d = _mm256_unpackhi_epi64(t1_, t3_);				\
+    } while(0)
+
+/* decrypts 8 blocks; in and out may overlap exactly */
+CAMELLIA_AVX2
+static void camellia_decrypt128_x8_avx2(const u32 *subkey,
+					const unsigned char *in,
+					unsigned char *out)
+{
+    const __m256i mask_ff = _mm256_set1_epi32(0xff);
+    /* GETU32/PUTU32: big-endian words */
+    const __m256i bswap = _mm256_setr_epi8(
+	3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12,
+	3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12);
+    __m256i x0 = _mm256_loadu_si256((const __m256i *)(in));      /* 0|1 */
+    __m256i x1 = _mm256_loadu_si256((const __m256i *)(in + 32)); /* 2|3 */
+    __m256i x2 = _mm256_loadu_si256((const __m256i *)(in + 64)); /* 4|5 */
+    __m256i x3 = _mm256_loadu_si256((const __m256i *)(in + 96)); /* 6|7 */
+    /* io[w] holds the word w of the blocks 0, 1, 2, 3 | 4, 5, 6, 7 */
+    __m256i io0 = _mm256_permute2x128_si256(x0, x2, 0x20);
+    __m256i io1 = _mm256_permute2x128_si256(x0, x2, 0x31);
+    __m256i io2 = _mm256_permute2x128_si256(x1, x3, 0x20);
+    __m256i io3 = _mm256_permute2x128_si256(x1, x3, 0x31);
+    __m256i t;
+
+    CAMELLIA_V_TRANSPOSE(io0, io1, io2, io3);
+    io0 = _mm256_shuffle_epi8(io0, bswap);
+    io1 = _mm256_shuffle_epi8(io1, bswap);
+    io2 = _mm256_shuffle_epi8(io2, bswap);
+    io3 = _mm256_shuffle_epi8(io3, bswap);
+
+    /* pre whitening but absorb kw2*/
+    io0 = _mm256_xor_si256(io0, _mm256_set1_epi32((int)CamelliaSubkeyL(24)));
+    io1 = _mm256_xor_si256(io1, _mm256_set1_epi32((int)CamelliaSubkeyR(24)));
+
+    /* main iteration */
+    CAMELLIA_V_ROUNDSM(io0, io1, 23, io2, io3);
+    CAMELLIA_V_ROUNDSM(io2, io3, 22, io0, io1);
+    CAMELLIA_V_ROUNDSM(io0, io1, 21, io2, io3);
+    CAMELLIA_V_ROUNDSM(io2, io3, 20, io0, io1);
+    CAMELLIA_V_ROUNDSM(io0, io1, 19, io2, io3);
+    CAMELLIA_V_ROUNDSM(io2, io3, 18, io0, io1);
+
+    CAMELLIA_V_FLS(io0, io1, io2, io3, 17, 16);
+
+    CAMELLIA_V_ROUNDSM(io0, io1, 15, io2, io3);
+    CAMELLIA_V_ROUNDSM(io2, io3, 14, io0, io1);
+    CAMELLIA_V_ROUNDSM(io0, io1, 13, io2, io3);
+    CAMELLIA_V_ROUNDSM(io2, io3, 12, io0, io1);
+    CAMELLIA_V_ROUNDSM(io0, io1, 11, io2, io3);
+    CAMELLIA_V_ROUNDSM(io2, io3, 10, io0, io1);
+
+    CAMELLIA_V_FLS(io0, io1, io2, io3, 9, 8);
+
+    CAMELLIA_V_ROUNDSM(io0, io1, 7, io2, io3);
+    CAMELLIA_V_ROUNDSM(io2, io3, 6, io0, io1);
+    CAMELLIA_V_ROUNDSM(io0, io1, 5, io2, io3);
+    CAMELLIA_V_ROUNDSM(io2, io3, 4, io0, io1);
+    CAMELLIA_V_ROUNDSM(io0, io1, 3, io2, io3);
+    CAMELLIA_V_ROUNDSM(io2, io3, 2, io0, io1);
+
+    /* post whitening but kw4 */
+    io2 = _mm256_xor_si256(io2, _mm256_set1_epi32((int)CamelliaSubkeyL(0)));
+    io3 = _mm256_xor_si256(io3, _mm256_set1_epi32((int)CamelliaSubkeyR(0)));
+
+    /* swap halves */
+    t = io0; io0 = io2; io2 = t;
+    t = io1; io1 = io3; io3 = t;
+
+    io0 = _mm256_shuffle_epi8(io0, bswap);
+    io1 = _mm256_shuffle_epi8(io1, bswap);
+    io2 = _mm256_shuffle_epi8(io2, bswap);
+    io3 = _mm256_shuffle_epi8(io3, bswap);
+    CAMELLIA_V_TRANSPOSE(io0, io1, io2, io3);
+    _mm256_storeu_si256((__m256i *)(out),
+			_mm256_permute2x128_si256(io0, io1, 0x20));
+    _mm256_storeu_si256((__m256i *)(out + 32),
+			_mm256_permute2x128_si256(io2, io3, 0x20));
+    _mm256_storeu_si256((__m256i *)(out + 64),
+			_mm256_permute2x128_si256(io0, io1, 0x31));
+    _mm256_storeu_si256((__m256i *)(out + 96),
+			_mm256_permute2x128_si256(io2, io3, 0x31));
+}
+
+static int camellia_cpu_has_avx2(void)
+{
+    /* -1: unknown, 0: no, 1: yes */
+    static int has_avx2 = -1;
+    if (has_avx2 < 0) {
+	__builtin_cpu_init();
+	has_avx2 = __builtin_cpu_supports("avx2") ? 1 : 0;
+    }
+    return has_avx2;
+}
+
+#endif /* CAMELLIA_HAVE_AVX2 */
+
+void Camellia_DecryptBlocks(const int keyBitLength,
+			    const unsigned char *ciphertext,
+			    const KEY_TABLE_TYPE keyTable,
+			    unsigned char *plaintext,
+			    size_t blockCount)
+{
+#ifdef CAMELLIA_HAVE_AVX2
+    if (keyBitLength == 128 && camellia_cpu_has_avx2()) {
+	for (; blockCount >= 8; blockCount -= 8) {
+	    camellia_decrypt128_x8_avx2(keyTable, ciphertext, plaintext);
+	    ciphertext += 8 * CAMELLIA_BLOCK_SIZE;
+	    plaintext += 8 * CAMELLIA_BLOCK_SIZE;
+	}
+    }
+#endif
+    /* the scalar path is the reference and handles the remainder */
+    for (; blockCount > 0; --blockCount) {
+	Camellia_DecryptBlock(keyBitLength, ciphertext, keyTable, plaintext);
+	ciphertext += CAMELLIA_BLOCK_SIZE;
+	plaintext += CAMELLIA_BLOCK_SIZE;
+    }
+}
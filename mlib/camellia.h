@@ -21,6 +21,8 @@
 #ifndef HEADER_CAMELLIA_H
 #define HEADER_CAMELLIA_H
 
+#include <stddef.h>
+
 #ifdef  __cplusplus
 extern "C" {
 #endif
@@ -46,6 +48,17 @@ void Camellia_DecryptBlock(const int keyBitLength,
 			   const KEY_TABLE_TYPE keyTable, 
 			   unsigned char *plaintext);
 
+/*
+ * Decrypts blockCount consecutive blocks (ECB). cipherText and plaintext
+ * may be the same buffer. 128-bit keys use a multi-block SIMD kernel
+ * when the CPU supports it.
+ */
+void Camellia_DecryptBlocks(const int keyBitLength,
+			    const unsigned char *cipherText,
+			    const KEY_TABLE_TYPE keyTable,
+			    unsigned char *plaintext,
+			    size_t blockCount);
+
 
 #ifdef  __cplusplus
 }
@@ -0,0 +1,190 @@
+/* crypto2.cc (updated on 2018/05/02)
+ * Copyright (C) 2018 renny1398.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ */
+
+#include <cstring>
+#include "crypto2.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define MLIB_CRYPTO2_X86 1
+#include <immintrin.h>
+#endif
+
+namespace {
+
+inline unsigned int rotl(unsigned int data, unsigned int bits) {
+ return (data << bits) | (data >> (32 - bits));
+}
+inline unsigned int rotr(unsigned int data, unsigned int bits) {
+ return (data >> bits) | (data << (32 - bits));
+}
+
+const unsigned char rotate_table[0x20] = {
+  0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x09,
+  0x0A, 0x0B, 0x0C, 0x0D, 0x0E, 0x0F, 0x11, 0x12,
+  0x13, 0x14, 0x15, 0x16, 0x17, 0x19, 0x1A, 0x1B,
+  0x1C, 0x1D, 0x1E, 0x1F, 0x04, 0x0C, 0x14, 0x1C
+};
+
+typedef void (*DecryptFunc)(const mlib::Crypto2KeyTable &, unsigned int,
+                            unsigned char *, size_t);
+
+// block = (dword0, dword1, dword2, dword3)
+// 1. xor every byte but the first with the first byte.
+// 2. dword[j] = rotl(dword[j] ^ key[pos][j], roll[pos][j])
+void DecryptBlocksScalar(const mlib::Crypto2KeyTable &table, unsigned int pos,
+                         unsigned char *buf, size_t block_count) {
+  for (size_t i = 0; i < block_count; ++i) {
+    uint64_t q[2];
+    ::memcpy(q, buf, 16);
+    const uint64_t x = static_cast<uint64_t>(buf[0]) * 0x0101010101010101ULL;
+    q[0] ^= x & ~static_cast<uint64_t>(0xff);  // little endian
+    q[1] ^= x;
+    unsigned int dw[4];
+    ::memcpy(dw, q, 16);
+    for (int j = 0; j < 4; ++j) {
+      dw[j] = rotl(dw[j] ^ table.key[pos][j], table.roll[pos][j]);
+    }
+    ::memcpy(buf, dw, 16);
+    buf += 16;
+    pos = (pos + 1) & (mlib::Crypto2KeyTable::kPositions - 1);
+  }
+}
+
+#ifdef MLIB_CRYPTO2_X86
+
+// one block per xmm register. variable rotations are done by 32x32->64
+// multiplications by (1 << roll): the low half is (x << roll) and the high
+// half is (x >> (32 - roll)).
+__attribute__((target("sse4.1")))
+void DecryptBlocksSSE41(const mlib::Crypto2KeyTable &table, unsigned int pos,
+                        unsigned char *buf, size_t block_count) {
+  const __m128i zero = _mm_setzero_si128();
+  const __m128i not_first = _mm_setr_epi8(0, -1, -1, -1, -1, -1, -1, -1,
+                                          -1, -1, -1, -1, -1, -1, -1, -1);
+  for (size_t i = 0; i < block_count; ++i) {
+    __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(buf));
+    const __m128i first = _mm_and_si128(_mm_shuffle_epi8(v, zero), not_first);
+    v = _mm_xor_si128(v, first);
+    v = _mm_xor_si128(v, _mm_loadu_si128(reinterpret_cast<const __m128i *>(table.key[pos])));
+    const __m128i mult = _mm_loadu_si128(reinterpret_cast<const __m128i *>(table.mult[pos]));
+    __m128i even = _mm_mul_epu32(v, mult);
+    even = _mm_or_si128(even, _mm_srli_epi64(even, 32));
+    __m128i odd = _mm_mul_epu32(_mm_srli_epi64(v, 32), _mm_srli_epi64(mult, 32));
+    odd = _mm_or_si128(odd, _mm_srli_epi64(odd, 32));
+    v = _mm_blend_epi16(even, _mm_slli_epi64(odd, 32), 0xcc);
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(buf), v);
+    buf += 16;
+    pos = (pos + 1) & (mlib::Crypto2KeyTable::kPositions - 1);
+  }
+}
+
+// two blocks per ymm register, eight blocks per iteration.
+__attribute__((target("avx2")))
+void DecryptBlocksAVX2(const mlib::Crypto2KeyTable &table, unsigned int pos,
+                       unsigned char *buf, size_t block_count) {
+  const __m256i zero = _mm256_setzero_si256();
+  const __m256i not_first = _mm256_setr_epi8(
+      0, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+      0, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1);
+  for (; block_count >= 8; block_count -= 8) {
+    for (int k = 0; k < 4; ++k) {
+      __m256i *p = reinterpret_cast<__m256i *>(buf + 32 * k);
+      const unsigned int row = pos + 2 * k;  // < kPositions * 2
+      __m256i v = _mm256_loadu_si256(p);
+      v = _mm256_xor_si256(v, _mm256_and_si256(_mm256_shuffle_epi8(v, zero), not_first));
+      v = _mm256_xor_si256(v, _mm256_loadu_si256(reinterpret_cast<const __m256i *>(table.key[row])));
+      const __m256i roll = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(table.roll[row]));
+      const __m256i unroll = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(table.unroll[row]));
+      v = _mm256_or_si256(_mm256_sllv_epi32(v, roll), _mm256_srlv_epi32(v, unroll));
+      _mm256_storeu_si256(p, v);
+    }
+    buf += 16 * 8;
+    pos = (pos + 8) & (mlib::Crypto2KeyTable::kPositions - 1);
+  }
+  DecryptBlocksSSE41(table, pos, buf, block_count);
+}
+
+DecryptFunc SelectDecryptFunc() {
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2")) return &DecryptBlocksAVX2;
+  if (__builtin_cpu_supports("sse4.1") && __builtin_cpu_supports("ssse3")) {
+    return &DecryptBlocksSSE41;
+  }
+  return &DecryptBlocksScalar;
+}
+
+#else
+
+DecryptFunc SelectDecryptFunc() {
+  return &DecryptBlocksScalar;
+}
+
+#endif // MLIB_CRYPTO2_X86
+
+} // namespace
+
+namespace mlib {
+
+void Crypto2_Ekeygen(const unsigned char key_string[16], Crypto2KeyTable *table) {
+  unsigned int key[4];
+  ::memcpy(key, key_string, 16);
+  for (unsigned int i = 0; i < Crypto2KeyTable::kPositions * 2; ++i) {
+    const unsigned int p = i & (Crypto2KeyTable::kPositions - 1);
+    const auto t = [p](int d) -> unsigned int { return rotate_table[(p + d) & 0x1f]; };
+    // rotr(x, n) == rotl(x, 32 - n) and every table value is in 1..31
+    table->key[i][0] = rotr(key[0], t(0x00));
+    table->roll[i][0] = 32 - t(0x0c);
+    table->key[i][1] = rotl(key[1], t(0x03));
+    table->roll[i][1] = t(0x0f);
+    table->key[i][2] = rotr(key[2], t(0x06));
+    table->roll[i][2] = 32 - t(-0x0e);
+    table->key[i][3] = rotl(key[3], t(0x09));
+    table->roll[i][3] = t(-0x0b);
+    for (int j = 0; j < 4; ++j) {
+      table->unroll[i][j] = 32 - table->roll[i][j];
+      table->mult[i][j] = 1U << table->roll[i][j];
+    }
+  }
+}
+
+void Crypto2_DecryptBlocks(const Crypto2KeyTable &table, uint64_t block_pos,
+                           unsigned char *buf, size_t block_count) {
+  static const DecryptFunc decrypt = SelectDecryptFunc();
+  decrypt(table, block_pos & (Crypto2KeyTable::kPositions - 1), buf, block_count);
+}
+
+void Crypto2_EncryptBlocks(const Crypto2KeyTable &table, uint64_t block_pos,
+                           unsigned char *buf, size_t block_count) {
+  // the inverse of DecryptBlocksScalar()
+  unsigned int pos = block_pos & (Crypto2KeyTable::kPositions - 1);
+  for (size_t i = 0; i < block_count; ++i) {
+    unsigned int dw[4];
+    ::memcpy(dw, buf, 16);
+    for (int j = 0; j < 4; ++j) {
+      dw[j] = rotr(dw[j], table.roll[pos][j]) ^ table.key[pos][j];
+    }
+    ::memcpy(buf, dw, 16);
+    for (int j = 1; j < 16; ++j) {
+      buf[j] ^= buf[0];
+    }
+    buf += 16;
+    pos = (pos + 1) & (Crypto2KeyTable::kPositions - 1);
+  }
+}
+
+} // namespace mlib
@@ -0,0 +1,67 @@
+#pragma once
+
+/* crypto2.h (updated on 2018/05/02)
+ * Copyright (C) 2018 renny1398.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+
+namespace mlib {
+
+////////////////////////////////////////////////////////////////////////
+/// @brief Key table of the cipher used on and after SLT
+///        (CipherType::kCipherEqualMoreThanSLT).
+////////////////////////////////////////////////////////////////////////
+
+struct Crypto2KeyTable {
+  // Every rotation depends only on (block position & 0x1f), so each row
+  // holds the rotated key words and the final rotation of one position.
+  // The 32 rows are stored twice so that a run of consecutive blocks
+  // never wraps around inside a SIMD iteration.
+  static const unsigned int kPositions = 32;
+  unsigned int key[kPositions * 2][4];
+  unsigned int roll[kPositions * 2][4];    // left rotation count (1..31)
+  unsigned int unroll[kPositions * 2][4];  // 32 - roll
+  unsigned int mult[kPositions * 2][4];    // 1 << roll
+};
+
+/**
+ * @brief Generate the key table from a 16-byte key string.
+ */
+void Crypto2_Ekeygen(const unsigned char key_string[16], Crypto2KeyTable *table);
+
+/**
+ * @brief Decrypt consecutive 16-byte blocks in place.
+ * @param[in] table a key table generated by Crypto2_Ekeygen().
+ * @param[in] block_pos the position of the first block (file offset / 16).
+ * @param[in,out] buf a buffer of block_count * 16 bytes.
+ * @param[in] block_count the count of blocks.
+ * @note This uses an AVX2 or SSE4.1 kernel when the CPU supports it,
+ *       and the result is identical to the scalar code.
+ */
+void Crypto2_DecryptBlocks(const Crypto2KeyTable &table, uint64_t block_pos,
+                           unsigned char *buf, size_t block_count);
+
+/**
+ * @brief Encrypt consecutive 16-byte blocks in place.
+ * @see Crypto2_DecryptBlocks()
+ */
+void Crypto2_EncryptBlocks(const Crypto2KeyTable &table, uint64_t block_pos,
+                           unsigned char *buf, size_t block_count);
+
+} // namespace mlib
@@ -0,0 +1,122 @@
+/* entry_ref.cc (updated on 2018/05/20)
+ * Copyright (C) 2018 renny1398.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ */
+
+#include <cstring>
+#include "entry_ref.h"
+#include "reader.h"
+#include "stats.h"
+
+namespace mlib {
+
+const uint32_t EntryTable::Node::kFlagFile;
+
+////////////////////////////////////////////////////////////////////////
+// EntryTable Class Function Definitions
+////////////////////////////////////////////////////////////////////////
+
+uint32_t EntryTable::AddNode(const std::string &name, bool is_file, int64_t base_offset, uint64_t size) {
+  Node node = {};
+  node.base_offset = base_offset;
+  node.size = size;
+  node.name_offset = static_cast<uint32_t>(name_storage_.size());
+  node.flags = is_file ? Node::kFlagFile : 0;
+  name_storage_.append(name.c_str(), name.size() + 1);
+  node_storage_.push_back(node);
+  nodes_ = node_storage_.data();
+  names_ = name_storage_.data();
+  return count_++;
+}
+
+void EntryTable::SetChildren(uint32_t index, uint32_t first_child, uint32_t child_count) {
+  node_storage_[index].first_child = first_child;
+  node_storage_[index].child_count = child_count;
+}
+
+void EntryTable::Attach(const Node *nodes, uint32_t count, const char *names,
+                        const std::shared_ptr<const void> &owner) {
+  node_storage_.clear();
+  name_storage_.clear();
+  owner_ = owner;
+  nodes_ = nodes;
+  names_ = names;
+  count_ = count;
+}
+
+////////////////////////////////////////////////////////////////////////
+// EntryRef Class Function Definitions
+////////////////////////////////////////////////////////////////////////
+
+EntryRef EntryRef::Parent() const noexcept {
+  if (table_ == nullptr) return EntryRef();
+  for (uint32_t i = 0; i < table_->size(); ++i) {
+    const EntryTable::Node &node = table_->node(i);
+    if ((node.flags & EntryTable::Node::kFlagFile) == 0 &&
+        node.first_child <= index_ && index_ - node.first_child < node.child_count) {
+      return EntryRef(table_, i);
+    }
+  }
+  return EntryRef();
+}
+
+EntryRef EntryRef::Child(const char *name, size_t length) const noexcept {
+  // search from the last child so that a duplicate name resolves to the last one
+  for (unsigned int i = child_count(); i > 0; --i) {
+    const EntryRef c = child(i - 1);
+    const char *child_name = c.name();
+    if (::strncmp(child_name, name, length) == 0 && child_name[length] == '\0') {
+      return c;
+    }
+  }
+  return EntryRef();
+}
+
+EntryRef EntryRef::GetEntry(const std::string &path) const noexcept {
+  EntryRef entry = *this;
+  size_t index = 0;
+  while (entry && index < path.size()) {
+    size_t delim_pos = path.find_first_of("/\\", index);
+    if (delim_pos == std::string::npos) delim_pos = path.size();
+    const char *name = path.data() + index;
+    const size_t length = delim_pos - index;
+    const bool is_dot = (length == 1 && name[0] == '.');
+    const bool is_dotdot = (length == 2 && name[0] == '.' && name[1] == '.');
+    if (is_dot || is_dotdot) {
+      // "." and ".." of a file are relative to the directory which has it
+      if (entry.IsFile()) entry = entry.Parent();
+      if (entry && is_dotdot) entry = entry.Parent();
+    } else if (length != 0) {
+      entry = entry.Child(name, length);
+    }
+    index = delim_pos + 1;
+  }
+  return entry;
+}
+
+size_t EntryRef::Read(off_t offset, size_t length, void *dest) const {
+  if ( !IsFile() ) return 0;
+  Stats::GetInstance().Add(Stats::kMLibReads);
+  const size_t file_size = size();
+  if (offset < 0 || static_cast<size_t>(offset) >= file_size) return 0;
+  if (file_size - offset < length) {
+    length = file_size - offset;
+  }
+  const off_t pos = static_cast<off_t>(table_->node(index_).base_offset) + offset;
+  return table_->reader()->Read(pos, length, dest);
+}
+
+} // namespace mlib
@@ -0,0 +1,211 @@
+#pragma once
+
+/* entry_ref.h (updated on 2018/05/20)
+ * Copyright (C) 2018 renny1398.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ */
+
+#include <sys/types.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace mlib {
+
+class Reader;
+
+////////////////////////////////////////////////////////////////////////
+/// @brief EntryTable class
+///
+/// A flat table of all entries of an archive. The children of a directory
+/// are the contiguous nodes [first_child, first_child + child_count).
+/// A table is built once per archive (see MLib::GetEntryRef()) and never
+/// changes, so it can be read from several threads.
+////////////////////////////////////////////////////////////////////////
+
+class EntryTable {
+public:
+  // the same layout as the nodes in an index file (see MLIDX_t)
+  struct Node {
+    int64_t base_offset;   // the offset of the contents in the reader
+    uint64_t size;
+    uint32_t name_offset;  // a NUL-terminated name in the name table
+    uint32_t first_child;
+    uint32_t child_count;
+    uint32_t flags;
+    static const uint32_t kFlagFile = 1;
+  };
+
+  explicit EntryTable(const std::shared_ptr<Reader> &reader) : reader_(reader), nodes_(nullptr),
+                                                               names_(nullptr), count_(0) {}
+
+  /**
+   * @brief Append a node.
+   * @return the index of the node.
+   */
+  uint32_t AddNode(const std::string &name, bool is_file, int64_t base_offset, uint64_t size);
+  /**
+   * @brief Set the children of a node.
+   */
+  void SetChildren(uint32_t index, uint32_t first_child, uint32_t child_count);
+  /**
+   * @brief Use nodes and names stored elsewhere instead of added ones.
+   * @param[in] owner an object which keeps the nodes and names alive.
+   */
+  void Attach(const Node *nodes, uint32_t count, const char *names,
+              const std::shared_ptr<const void> &owner);
+
+  uint32_t size() const noexcept { return count_; }
+  const Node &node(uint32_t i) const noexcept { return nodes_[i]; }
+  const char *name(uint32_t i) const noexcept { return names_ + nodes_[i].name_offset; }
+  Reader *reader() const noexcept { return reader_.get(); }
+
+private:
+  EntryTable(const EntryTable &) = delete;
+  EntryTable &operator=(const EntryTable &) = delete;
+
+  const std::shared_ptr<Reader> reader_;
+  std::vector<Node> node_storage_;
+  std::string name_storage_;
+  std::shared_ptr<const void> owner_;
+  const Node *nodes_;
+  const char *names_;
+  uint32_t count_;
+};
+
+////////////////////////////////////////////////////////////////////////
+/// @brief EntryRef class
+///
+/// A copyable handle of an entry: a pointer to the entry table of its
+/// archive and an index in it. None of its functions allocate memory.
+/// A handle is valid while the MLib entries of its archive are open, and
+/// copies of it may be used from any thread.
+////////////////////////////////////////////////////////////////////////
+
+class EntryRef {
+public:
+  class ChildIterator {
+  public:
+    ChildIterator(const EntryTable *table, uint32_t index) noexcept : table_(table), index_(index) {}
+    EntryRef operator*() const noexcept { return EntryRef(table_, index_); }
+    ChildIterator &operator++() noexcept { ++index_; return *this; }
+    bool operator==(const ChildIterator &rhs) const noexcept { return index_ == rhs.index_; }
+    bool operator!=(const ChildIterator &rhs) const noexcept { return index_ != rhs.index_; }
+  private:
+    const EntryTable *table_;
+    uint32_t index_;
+  };
+
+  class ChildRange {
+  public:
+    ChildRange(ChildIterator begin, ChildIterator end) noexcept : begin_(begin), end_(end) {}
+    ChildIterator begin() const noexcept { return begin_; }
+    ChildIterator end() const noexcept { return end_; }
+  private:
+    ChildIterator begin_;
+    ChildIterator end_;
+  };
+
+  EntryRef() noexcept : table_(nullptr), index_(0) {}
+  EntryRef(const EntryTable *table, uint32_t index) noexcept : table_(table), index_(index) {}
+
+  /**
+   * @brief Check whether this handle refers to an entry.
+   */
+  explicit operator bool() const noexcept { return table_ != nullptr; }
+  bool operator==(const EntryRef &rhs) const noexcept {
+    return table_ == rhs.table_ && index_ == rhs.index_;
+  }
+  bool operator!=(const EntryRef &rhs) const noexcept { return !(*this == rhs); }
+
+  bool IsFile() const noexcept {
+    return table_ && (table_->node(index_).flags & EntryTable::Node::kFlagFile);
+  }
+  bool IsDirectory() const noexcept {
+    return table_ && !IsFile();
+  }
+  /**
+   * @brief Returns the entry name in UTF-8.
+   */
+  const char *name() const noexcept {
+    return table_ ? table_->name(index_) : "";
+  }
+  size_t size() const noexcept {
+    return table_ ? static_cast<size_t>(table_->node(index_).size) : 0;
+  }
+  uint32_t index() const noexcept { return index_; }
+
+  /**
+   * @brief Returns the count of the children of this directory.
+   */
+  unsigned int child_count() const noexcept {
+    return IsDirectory() ? table_->node(index_).child_count : 0;
+  }
+  /**
+   * @brief Returns the ith child (0 <= i < child_count()).
+   */
+  EntryRef child(unsigned int i) const noexcept {
+    return EntryRef(table_, table_->node(index_).first_child + i);
+  }
+  /**
+   * @brief Returns a range of the children for range-based for loops.
+   */
+  ChildRange children() const noexcept {
+    const uint32_t first = IsDirectory() ? table_->node(index_).first_child : 0;
+    return ChildRange(ChildIterator(table_, first), ChildIterator(table_, first + child_count()));
+  }
+
+  /**
+   * @brief Returns the directory which has this entry.
+   * @return the parent, or an invalid handle for the root.
+   * @note The table has no links to parents, so this scans it.
+   */
+  EntryRef Parent() const noexcept;
+
+  /**
+   * @brief Find a child by its name.
+   * @return the child if found, and an invalid handle otherwise. A name
+   *         which appears twice resolves to the last one, as MLib::Child().
+   */
+  EntryRef Child(const char *name, size_t length) const noexcept;
+  EntryRef Child(const std::string &name) const noexcept {
+    return Child(name.data(), name.size());
+  }
+  /**
+   * @brief Find an entry by a relative path separated with '/' or '\\'.
+   *        "." and ".." are resolved as MLib::GetEntry() does, but an
+   *        empty name (e.g. "a//b") is skipped, where MLib::GetEntry() stops.
+   * @return the entry if found, and an invalid handle otherwise.
+   */
+  EntryRef GetEntry(const std::string &path) const noexcept;
+
+  /**
+   * @brief Read the contents of this file.
+   * @param[in] offset an offset from the beginning of this file.
+   * @param[in] length the count of bytes to read.
+   * @param[out] dest a buffer of length bytes at least.
+   * @return the count of read bytes.
+   */
+  size_t Read(off_t offset, size_t length, void *dest) const;
+
+private:
+  const EntryTable *table_;
+  uint32_t index_;
+};
+
+} // namespace mlib
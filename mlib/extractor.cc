@@ -18,15 +18,20 @@
 
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <fcntl.h>
 #include <unistd.h>
 #include <cassert>
 #include <SDL.h>
 #include <SDL_image.h>
+#include <algorithm>
+#include <deque>
+#include <functional>
 #include <iostream>
 #include <sstream>
 #include <fstream>
 #include <memory>
 #include "reader.h"
+#include "io_engine.h"
 #include "extractor.h"
 
 namespace {
@@ -276,6 +281,18 @@ bool Extractor::Extract(VersionedEntry* p_entry, const std::string& fs_path, std
     std::cout << "-- Extracting '" << p_entry->GetFullPath() << "...";
     std::cout.flush();
 
+    size_t entry_ext_index = entry_name.find_last_of(".");
+    const std::string entry_ext =
+        (entry_ext_index == std::string::npos) ? "" :
+        entry_name.substr(entry_name.find_last_of("."));
+
+    if ( !(webp2png_ && entry_ext == ".webp") ) {
+      if (QueueJob(p_entry, fs_path_tmp + entry_name, mgf2png_ && entry_ext == ".mgf")) {
+        std::cout << "queued." << std::endl;
+        return true;
+      }
+    }
+
     off_t file_pos_tmp = p_entry->Seek(0, SEEK_CUR); /*p_entry->Tell()*/;
     p_entry->Seek(0, SEEK_SET);
     if (buf.size() < size) {
@@ -285,11 +302,6 @@ bool Extractor::Extract(VersionedEntry* p_entry, const std::string& fs_path, std
     size = p_entry->Read(size, buf_ptr);
     p_entry->Seek(file_pos_tmp, SEEK_SET);
 
-    size_t entry_ext_index = entry_name.find_last_of(".");
-    const std::string entry_ext =
-        (entry_ext_index == std::string::npos) ? "" :
-        entry_name.substr(entry_name.find_last_of("."));
-
     fs_path_tmp.append(entry_name);
 
     if (mgf2png_ && entry_ext == ".mgf") {
@@ -381,6 +393,256 @@ bool Extractor::Extract(VersionedEntry* p_entry, const std::string& fs_path, std
   return true;
 }
 
+bool Extractor::QueueJob(VersionedEntry* p_entry, const std::string& out_path, bool mgf2png) {
+  const MLib* p_mlib = p_entry->GetCurrentMLib();
+  if (p_mlib == nullptr) return false;
+  const std::shared_ptr<Reader>& reader = p_mlib->reader();
+  if (p_mlib->GetView() == nullptr && reader->GetFileDescriptor() == -1) {
+    return false;
+  }
+  ExtractJob job;
+  job.reader = reader;
+  job.offset = p_mlib->GetBaseOffset();
+  job.size = p_mlib->GetSize();
+  job.entry_path = p_entry->GetFullPath();
+  job.out_path = out_path;
+  job.mgf2png = mgf2png;
+  jobs_.push_back(std::move(job));
+  return true;
+}
+
+bool Extractor::RunJobs() {
+  // the jobs are sorted by where their contents are in the libraries, and
+  // the contents of neighbouring jobs are read at once and then split per
+  // file, so that a library is read from the beginning to the end in large
+  // requests. each file is decoded and written to a new file. the requests
+  // of many jobs are kept in flight at once so that the device sees a deep
+  // queue.
+  static const size_t kMaxBufferedBytes = 256 * 1024 * 1024;
+  static const size_t kMaxReadBytes = 16 * 1024 * 1024;  // of a coalesced read
+  static const size_t kMaxGapBytes = 64 * 1024;  // read through a gap smaller than this
+  enum Phase { kRead, kOpen, kWrite };
+  struct Task {
+    const ExtractJob *job;  // the first of the jobs which a read covers
+    size_t job_count;
+    Phase phase;
+    std::shared_ptr< std::vector<char> > buf;  // shared by the files split from a read
+    off_t raw_offset;   // the block-aligned range read from the reader
+    size_t raw_size;
+    const char *data;   // the contents to write
+    size_t data_size;
+    const char *header; // written instead of the first 8 bytes of data
+    size_t done;
+    int out_fd;
+  };
+  struct Read {
+    size_t first_job;
+    size_t job_count;
+    off_t end;          // the end of the contents of the jobs
+  };
+  if (jobs_.empty()) return true;
+
+  // plan the reads
+  std::stable_sort(jobs_.begin(), jobs_.end(), [](const ExtractJob &lhs, const ExtractJob &rhs) {
+    if (lhs.reader != rhs.reader) return std::less<Reader*>()(lhs.reader.get(), rhs.reader.get());
+    return lhs.offset < rhs.offset;
+  });
+  std::vector<Read> reads;
+  for (size_t i = 0; i < jobs_.size(); ++i) {
+    const ExtractJob &job = jobs_[i];
+    const off_t job_end = job.offset + job.size;
+    // the contents in a mapped library are written without reading
+    const bool mapped = (job.reader->GetView(job.offset, job.size) != nullptr);
+    if ( !mapped && !reads.empty() ) {
+      Read &last = reads.back();
+      const ExtractJob &first = jobs_[last.first_job];
+      const off_t end = std::max(last.end, job_end);
+      if (first.reader == job.reader && last.first_job + last.job_count == i &&
+          job.reader->GetView(first.offset, first.size) == nullptr &&
+          job.offset <= last.end + static_cast<off_t>(kMaxGapBytes) &&
+          end - first.offset <= static_cast<off_t>(kMaxReadBytes)) {
+        ++last.job_count;
+        last.end = end;
+        continue;
+      }
+    }
+    Read read;
+    read.first_job = i;
+    read.job_count = 1;
+    read.end = job_end;
+    reads.push_back(read);
+  }
+
+  std::unique_ptr<IoEngine> engine(IoEngine::Create(async_io_ ? queue_depth_ : 1, async_io_));
+  std::cout << "[Info] Extractor: writing " << jobs_.size() << " files in "
+            << reads.size() << " reads with " << engine->name()
+            << " (queue depth = " << engine->queue_depth() << ")." << std::endl;
+
+  bool ret = true;
+  size_t next_read = 0;
+  size_t buffered_bytes = 0;
+  size_t task_count = 0;
+  std::deque<Task*> ready;  // the files split from reads, waiting for a free slot
+
+  auto finish = [&](Task *t, bool ok) {
+    if (t->out_fd != -1) ::close(t->out_fd);
+    for (size_t i = 0; i < t->job_count; ++i) {
+      if (ok) {
+        std::cout << "-- Extracted '" << t->job[i].entry_path << "'." << std::endl;
+      } else {
+        std::cerr << "[Error] Extractor: failed to extract '"
+                  << t->job[i].entry_path << "'." << std::endl;
+        ret = false;
+      }
+    }
+    if (t->buf && t->buf.use_count() == 1) {
+      buffered_bytes -= t->buf->size();
+    }
+    --task_count;
+    delete t;
+  };
+  auto submit = [&](Task *t) {
+    IoEngine::Request request;
+    request.user_data = t;
+    if (t->phase == kRead) {
+      request.fd = t->job->reader->GetFileDescriptor();
+      request.buf = t->buf->data() + t->done;
+      request.length = t->raw_size - t->done;
+      request.offset = t->raw_offset + t->done;
+      request.write = false;
+    } else {
+      const bool in_header = t->header && t->done < 8;
+      request.fd = t->out_fd;
+      request.buf = const_cast<char *>((in_header ? t->header : t->data) + t->done);
+      request.length = (in_header ? 8 : t->data_size) - t->done;
+      request.offset = t->done;
+      request.write = true;
+    }
+    if (engine->Submit(request) == false) {
+      finish(t, false);
+    }
+  };
+  // advance a task until it sends a request or finishes
+  auto advance = [&](Task *t) {
+    if (t->phase == kRead) {
+      if (t->done < t->raw_size) {
+        submit(t);
+        return;
+      }
+      const size_t block_size = t->job->reader->GetBlockSize();
+      if (t->done != 0) {
+        t->job->reader->Decode(t->raw_offset, t->buf->data(),
+                               (t->done + block_size - 1) / block_size * block_size);
+      }
+      // split the read into the files. this task goes on with the first one.
+      const size_t read_bytes = t->done;
+      for (size_t i = t->job_count; i-- > 0; ) {
+        Task *f = (i == 0) ? t : new Task(*t);
+        const ExtractJob &job = t->job[i];
+        const size_t head = job.offset - t->raw_offset;
+        f->job = &job;
+        f->job_count = 1;
+        f->data = t->buf->data() + head;
+        f->data_size = (read_bytes > head) ? std::min(job.size, read_bytes - head) : 0;
+        f->phase = kOpen;
+        if (i != 0) {
+          ++task_count;
+          ready.push_front(f);
+        }
+      }
+    }
+    if (t->phase == kOpen) {
+      // a short read (e.g. a truncated library) must not be written as a whole file
+      if (t->data_size < t->job->size) {
+        std::cerr << "[Error] Extractor: read " << t->data_size << " of " << t->job->size
+                  << " bytes of '" << t->job->entry_path << "'." << std::endl;
+        finish(t, false);
+        return;
+      }
+      std::string out_path(t->job->out_path);
+      if (t->job->mgf2png && t->data_size >= 8 && !::memcmp(t->data, mgf_header, 8)) {
+        out_path.erase(out_path.size() - 4);
+        out_path.append(".png");
+        t->header = png_header;
+      }
+      t->out_fd = ::open(out_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+      if (t->out_fd == -1) {
+        std::cerr << "[Error] Extractor: failed to create the file '"
+                  << out_path << "'." << std::endl;
+        finish(t, false);
+        return;
+      }
+      t->phase = kWrite;
+      t->done = 0;
+    }
+    if (t->done < t->data_size) {
+      submit(t);
+      return;
+    }
+    finish(t, true);
+  };
+
+  std::vector<IoEngine::Completion> completions;
+  while (task_count != 0 || (next_read < reads.size() && !stop_)) {
+    while ( !ready.empty() && engine->GetInFlightCount() < engine->queue_depth() ) {
+      Task *t = ready.front();
+      ready.pop_front();
+      advance(t);
+    }
+    while (ready.empty() && next_read < reads.size() && !stop_ &&
+           engine->GetInFlightCount() < engine->queue_depth() &&
+           (task_count == 0 || buffered_bytes < kMaxBufferedBytes)) {
+      const Read &read = reads[next_read++];
+      const ExtractJob &job = jobs_[read.first_job];
+      Task *t = new Task();
+      t->job = &job;
+      t->job_count = read.job_count;
+      t->header = nullptr;
+      t->done = 0;
+      t->out_fd = -1;
+      t->data = job.reader->GetView(job.offset, job.size);
+      if (t->data) {
+        t->phase = kOpen;
+        t->data_size = job.size;
+        t->raw_offset = job.offset;
+        t->raw_size = 0;
+      } else {
+        const size_t block_size = job.reader->GetBlockSize();
+        const size_t end = (read.end + block_size - 1) / block_size * block_size;
+        t->phase = kRead;
+        t->raw_offset = job.offset - job.offset % block_size;
+        t->raw_size = std::min(end, job.reader->GetSize()) - t->raw_offset;
+        t->buf = std::make_shared< std::vector<char> >(end - t->raw_offset);
+        buffered_bytes += t->buf->size();
+      }
+      ++task_count;
+      advance(t);
+    }
+    if (engine->GetInFlightCount() == 0) continue;
+    completions.clear();
+    if (engine->Wait(&completions) == 0) {
+      // the buffers of the requests in flight must not be freed.
+      std::cerr << "[Error] Extractor: failed to wait for I/O." << std::endl;
+      jobs_.clear();
+      return false;
+    }
+    for (const auto &c : completions) {
+      Task *t = static_cast<Task *>(c.user_data);
+      if (c.result < 0 || (c.result == 0 && t->phase == kWrite)) {
+        finish(t, false);
+        continue;
+      }
+      if (c.result == 0) {
+        t->raw_size = t->done;  // reach EOF
+      }
+      t->done += c.result;
+      advance(t);
+    }
+  }
+  jobs_.clear();
+  return ret;
+}
+
 bool Extractor::Extract(VersionedEntry* p_entry, const std::string& /*fs_path*/) {
   stop_ = false;
 
@@ -402,6 +664,7 @@ bool Extractor::Extract(VersionedEntry* p_entry, const std::string& /*fs_path*/)
   std::vector<char> buf;  // for reading file contents
   const clock_t clk = ::clock();
   bool ret = Extract(p_entry, fs_path_tmp, buf);
+  ret = RunJobs() && ret;
   if (ret == false) {
     std::cerr << "[Error] Extractor: failed to extract files." << std::endl;
     return ret;
@@ -26,7 +26,8 @@ class Extractor {
 
 public:
   Extractor()
-    : flatten_(false), mgf2png_(true), webp2png_(true), texcat_(true), texlv_(0), svg_(false), stop_(false) {}
+    : flatten_(false), mgf2png_(true), webp2png_(true), texcat_(true), texlv_(0), svg_(false),
+      async_io_(false), queue_depth_(kDefaultQueueDepth), stop_(false) {}
 
   static void Initialize();
   static void Finalize();
@@ -42,16 +43,38 @@ public:
     return true;
   }
 
+  // files are extracted after the whole tree is visited, in the order of
+  // their contents in the libraries, and neighbouring files are read at
+  // once (see RunJobs()). image conversions other than mgf2png are done
+  // while visiting the tree.
+  // keep many reads and writes in flight with IoEngine (io_uring if
+  // available). without it, the requests are sent one at a time.
+  void EnableAsyncIO(bool b = true) { async_io_ = b; }
+  void SetQueueDepth(unsigned int depth) { queue_depth_ = depth; }
+
   bool Extract(VersionedEntry* p_entry, const std::string& fs_path);
   void Stop() { stop_ = true; }
 
 protected:
+  struct ExtractJob {
+    std::shared_ptr<Reader> reader;  // keeps the library open
+    off_t offset;                    // the file contents offset in the reader
+    size_t size;
+    std::string entry_path;
+    std::string out_path;
+    bool mgf2png;
+  };
+
+  bool QueueJob(VersionedEntry* p_entry, const std::string& out_path, bool mgf2png);
+  bool RunJobs();
+
   bool Extract(VersionedEntry* p_entry, const std::string& fs_path, std::vector<char>& buf);
   bool TexCat(VersionedEntry* dzi, const VersionedEntry* tex_entry, const std::string &fs_path, std::vector<char> &buf);
 
 private:
   static const char kDelim;
   static const char kDelimNotUsed;
+  static const unsigned int kDefaultQueueDepth = 64;
 
   bool flatten_;
   bool mgf2png_;
@@ -59,6 +82,9 @@ private:
   bool texcat_;
   int texlv_;
   bool svg_;
+  bool async_io_;
+  unsigned int queue_depth_;
+  std::vector<ExtractJob> jobs_;
 
   volatile bool stop_;
 };
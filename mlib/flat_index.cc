@@ -0,0 +1,105 @@
+/* flat_index.cc (updated on 2018/05/18)
+ * Copyright (C) 2018 renny1398.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ */
+
+#include <cstring>
+#include "flat_index.h"
+
+namespace mlib {
+
+const size_t FlatIndex::npos;
+const uint32_t FlatIndex::kEmpty;
+
+uint32_t FlatIndex::Hash(const char *name, size_t length) noexcept {
+  // FNV-1a
+  uint32_t h = 2166136261U;
+  for (size_t i = 0; i < length; ++i) {
+    h ^= static_cast<unsigned char>(name[i]);
+    h *= 16777619U;
+  }
+  return h;
+}
+
+bool FlatIndex::Equals(uint32_t index, const char *name, size_t length) const noexcept {
+  const uint32_t begin = offsets_[index];
+  return offsets_[index + 1] - begin == length &&
+         ::memcmp(names_.data() + begin, name, length) == 0;
+}
+
+void FlatIndex::Reserve(size_t count) {
+  offsets_.reserve(count + 1);
+  hashes_.reserve(count);
+  size_t slot_count = 16;
+  while (slot_count < count * 2) slot_count *= 2;
+  if (slots_.size() < slot_count) Rehash(slot_count);
+}
+
+void FlatIndex::Rehash(size_t slot_count) {
+  slots_.assign(slot_count, kEmpty);
+  for (size_t i = 0; i < count_; ++i) {
+    Insert(static_cast<uint32_t>(i));
+  }
+}
+
+void FlatIndex::Insert(uint32_t index) noexcept {
+  const uint32_t begin = offsets_[index];
+  const char *name = names_.data() + begin;
+  const size_t length = offsets_[index + 1] - begin;
+  const uint32_t h = hashes_[index];
+  const size_t mask = slots_.size() - 1;
+  size_t s = h & mask;
+  // a later duplicate takes the slot of the earlier one
+  while (slots_[s] != kEmpty &&
+         !(hashes_[slots_[s]] == h && Equals(slots_[s], name, length))) {
+    s = (s + 1) & mask;
+  }
+  slots_[s] = index;
+}
+
+size_t FlatIndex::Add(const char *name, size_t length) {
+  // keep the load factor at most 1/2
+  if (slots_.size() < (count_ + 1) * 2) {
+    Rehash(slots_.empty() ? 16 : slots_.size() * 2);
+  }
+  if (offsets_.empty()) offsets_.push_back(0);
+  names_.append(name, length);
+  offsets_.push_back(static_cast<uint32_t>(names_.size()));
+  hashes_.push_back(Hash(name, length));
+  Insert(static_cast<uint32_t>(count_));
+  return count_++;
+}
+
+size_t FlatIndex::Find(const char *name, size_t length) const noexcept {
+  if (count_ == 0) return npos;
+  const uint32_t h = Hash(name, length);
+  const size_t mask = slots_.size() - 1;
+  for (size_t s = h & mask; slots_[s] != kEmpty; s = (s + 1) & mask) {
+    const uint32_t index = slots_[s];
+    if (hashes_[index] == h && Equals(index, name, length)) return index;
+  }
+  return npos;
+}
+
+void FlatIndex::clear() noexcept {
+  count_ = 0;
+  names_.clear();
+  offsets_.clear();
+  hashes_.clear();
+  slots_.clear();
+}
+
+} // namespace mlib
@@ -0,0 +1,85 @@
+#pragma once
+
+/* flat_index.h (updated on 2018/05/18)
+ * Copyright (C) 2018 renny1398.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ */
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string>
+#include <vector>
+
+namespace mlib {
+
+////////////////////////////////////////////////////////////////////////
+/// @brief An open-addressing hash index from names to their indices.
+///
+/// The names are packed in one buffer, and Find() takes a pointer and a
+/// length, so a lookup neither copies nor allocates. The ith added name
+/// has the index i. Once built, it can be searched from several threads.
+////////////////////////////////////////////////////////////////////////
+
+class FlatIndex {
+public:
+  static const size_t npos = static_cast<size_t>(-1);
+
+  FlatIndex() : count_(0) {}
+
+  /**
+   * @brief Reserve memory for the given count of names.
+   */
+  void Reserve(size_t count);
+
+  /**
+   * @brief Add a name. A duplicate name has its own index, and Find()
+   *        returns the index of the last one (as std::map::operator[]).
+   * @return the index of the name.
+   */
+  size_t Add(const char *name, size_t length);
+  size_t Add(const std::string &name) {
+    return Add(name.data(), name.size());
+  }
+
+  /**
+   * @brief Find a name.
+   * @return the index of the name if found, and npos otherwise.
+   */
+  size_t Find(const char *name, size_t length) const noexcept;
+  size_t Find(const std::string &name) const noexcept {
+    return Find(name.data(), name.size());
+  }
+
+  size_t size() const noexcept { return count_; }
+  bool empty() const noexcept { return count_ == 0; }
+  void clear() noexcept;
+
+private:
+  static const uint32_t kEmpty = 0xffffffffU;
+
+  static uint32_t Hash(const char *name, size_t length) noexcept;
+  bool Equals(uint32_t index, const char *name, size_t length) const noexcept;
+  void Rehash(size_t slot_count);
+  void Insert(uint32_t index) noexcept;
+
+  size_t count_;
+  std::string names_;              // all names back to back
+  std::vector<uint32_t> offsets_;  // the ith name is names_[offsets_[i], offsets_[i+1])
+  std::vector<uint32_t> hashes_;
+  std::vector<uint32_t> slots_;    // indices, or kEmpty
+};
+
+} // namespace mlib
@@ -0,0 +1,43 @@
+#pragma once
+
+/* fnv1a.h (updated on 2018/05/26)
+ * Copyright (C) 2018 renny1398.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+
+namespace mlib {
+
+// the 64-bit FNV-1a hash. it keys files on disk (shadow copies, index
+// files), so the values must never change.
+const uint64_t kFnv1aOffsetBasis = 0xcbf29ce484222325ULL;
+
+/**
+ * @brief Hash bytes into h.
+ * @param[in] h kFnv1aOffsetBasis, or the hash of the preceding bytes.
+ */
+inline uint64_t Fnv1a(uint64_t h, const void *data, size_t length) noexcept {
+  const unsigned char *p = static_cast<const unsigned char *>(data);
+  for (size_t i = 0; i < length; ++i) {
+    h ^= p[i];
+    h *= 0x100000001b3ULL;
+  }
+  return h;
+}
+
+} // namespace mlib
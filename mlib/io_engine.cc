@@ -0,0 +1,318 @@
+/* io_engine.cc (updated on 2018/05/08)
+ * Copyright (C) 2018 renny1398.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ */
+
+#include <sys/types.h>
+#include <sys/uio.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstring>
+#include <algorithm>
+#include <condition_variable>
+#include <deque>
+#include <iostream>
+#include <mutex>
+#include <thread>
+#include "io_engine.h"
+#include "stats.h"
+
+#if defined(__linux__) && defined(__NR_io_uring_setup)
+#include <linux/io_uring.h>
+#define MLIB_HAVE_IO_URING 1
+#endif
+
+namespace {
+
+using mlib::IoEngine;
+
+////////////////////////////////////////////////////////////////////////
+// thread pool backend
+////////////////////////////////////////////////////////////////////////
+
+class ThreadPoolEngine : public IoEngine {
+public:
+  explicit ThreadPoolEngine(unsigned int queue_depth)
+    : IoEngine(queue_depth), in_flight_(0), stop_(false) {
+    unsigned int n = std::max(1U, std::thread::hardware_concurrency());
+    n = std::min(n * 2, queue_depth);
+    for (unsigned int i = 0; i < n; ++i) {
+      workers_.emplace_back(&ThreadPoolEngine::Work, this);
+    }
+  }
+
+  ~ThreadPoolEngine() {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      stop_ = true;
+    }
+    request_cv_.notify_all();
+    for (auto &t : workers_) {
+      t.join();
+    }
+  }
+
+  const char *name() const noexcept override {
+    return "threads";
+  }
+
+  bool Submit(const Request &request) override {
+    if (in_flight_ >= queue_depth()) return false;
+    ++in_flight_;
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      requests_.push_back(request);
+    }
+    request_cv_.notify_one();
+    return true;
+  }
+
+  size_t Wait(std::vector<Completion> *completions) override {
+    if (in_flight_ == 0) return 0;
+    std::unique_lock<std::mutex> lock(mutex_);
+    completion_cv_.wait(lock, [this]() { return !completions_.empty(); });
+    const size_t count = completions_.size();
+    completions->insert(completions->end(), completions_.begin(), completions_.end());
+    completions_.clear();
+    in_flight_ -= count;
+    return count;
+  }
+
+  unsigned int GetInFlightCount() const noexcept override {
+    return in_flight_;
+  }
+
+private:
+  void Work() {
+    for (;;) {
+      Request request;
+      {
+        std::unique_lock<std::mutex> lock(mutex_);
+        request_cv_.wait(lock, [this]() { return stop_ || !requests_.empty(); });
+        if (requests_.empty()) return;
+        request = requests_.front();
+        requests_.pop_front();
+      }
+      const ssize_t ret = request.write ?
+          ::pwrite(request.fd, request.buf, request.length, request.offset) :
+          ::pread(request.fd, request.buf, request.length, request.offset);
+      mlib::Stats &stats = mlib::Stats::GetInstance();
+      stats.Add(mlib::Stats::kSyscalls);
+      if (!request.write && ret > 0) stats.Add(mlib::Stats::kBytesRead, ret);
+      {
+        std::lock_guard<std::mutex> lock(mutex_);
+        completions_.push_back({ request.user_data, (ret < 0) ? -errno : ret });
+      }
+      completion_cv_.notify_one();
+    }
+  }
+
+  unsigned int in_flight_;  // only touched by the owner thread
+  bool stop_;
+  std::mutex mutex_;
+  std::condition_variable request_cv_;
+  std::condition_variable completion_cv_;
+  std::deque<Request> requests_;
+  std::vector<Completion> completions_;
+  std::vector<std::thread> workers_;
+};
+
+#ifdef MLIB_HAVE_IO_URING
+
+////////////////////////////////////////////////////////////////////////
+// io_uring backend (without liburing)
+////////////////////////////////////////////////////////////////////////
+
+class UringEngine : public IoEngine {
+public:
+  explicit UringEngine(unsigned int queue_depth)
+    : IoEngine(queue_depth), ring_fd_(-1), sq_ring_(MAP_FAILED), cq_ring_(MAP_FAILED),
+      sqes_(static_cast<io_uring_sqe *>(MAP_FAILED)), sq_ring_size_(0), cq_ring_size_(0), sq_entries_(0),
+      to_submit_(0), in_flight_(0), slots_(queue_depth) {
+    struct io_uring_params params;
+    ::memset(&params, 0, sizeof(params));
+    ring_fd_ = static_cast<int>(::syscall(__NR_io_uring_setup, queue_depth, &params));
+    if (ring_fd_ == -1) return;
+    sq_ring_size_ = params.sq_off.array + params.sq_entries * sizeof(unsigned int);
+    cq_ring_size_ = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+    sq_ring_ = ::mmap(nullptr, sq_ring_size_, PROT_READ | PROT_WRITE,
+                      MAP_SHARED | MAP_POPULATE, ring_fd_, IORING_OFF_SQ_RING);
+    cq_ring_ = ::mmap(nullptr, cq_ring_size_, PROT_READ | PROT_WRITE,
+                      MAP_SHARED | MAP_POPULATE, ring_fd_, IORING_OFF_CQ_RING);
+    sqes_ = static_cast<io_uring_sqe *>(
+        ::mmap(nullptr, params.sq_entries * sizeof(io_uring_sqe), PROT_READ | PROT_WRITE,
+               MAP_SHARED | MAP_POPULATE, ring_fd_, IORING_OFF_SQES));
+    sq_entries_ = params.sq_entries;
+    if (sq_ring_ == MAP_FAILED || cq_ring_ == MAP_FAILED || sqes_ == MAP_FAILED) return;
+    char *sq = static_cast<char *>(sq_ring_);
+    sq_head_ = reinterpret_cast<unsigned int *>(sq + params.sq_off.head);
+    sq_tail_ = reinterpret_cast<unsigned int *>(sq + params.sq_off.tail);
+    sq_mask_ = *reinterpret_cast<unsigned int *>(sq + params.sq_off.ring_mask);
+    sq_array_ = reinterpret_cast<unsigned int *>(sq + params.sq_off.array);
+    char *cq = static_cast<char *>(cq_ring_);
+    cq_head_ = reinterpret_cast<unsigned int *>(cq + params.cq_off.head);
+    cq_tail_ = reinterpret_cast<unsigned int *>(cq + params.cq_off.tail);
+    cq_mask_ = *reinterpret_cast<unsigned int *>(cq + params.cq_off.ring_mask);
+    cqes_ = reinterpret_cast<io_uring_cqe *>(cq + params.cq_off.cqes);
+    for (unsigned int i = 0; i < queue_depth; ++i) {
+      free_slots_.push_back(queue_depth - 1 - i);
+    }
+  }
+
+  ~UringEngine() {
+    if (sqes_ != MAP_FAILED) ::munmap(sqes_, sq_entries_ * sizeof(io_uring_sqe));
+    if (cq_ring_ != MAP_FAILED) ::munmap(cq_ring_, cq_ring_size_);
+    if (sq_ring_ != MAP_FAILED) ::munmap(sq_ring_, sq_ring_size_);
+    if (ring_fd_ != -1) ::close(ring_fd_);
+  }
+
+  bool IsOpen() const noexcept {
+    return ring_fd_ != -1 && sq_ring_ != MAP_FAILED &&
+           cq_ring_ != MAP_FAILED && sqes_ != MAP_FAILED;
+  }
+
+  const char *name() const noexcept override {
+    return "io_uring";
+  }
+
+  bool Submit(const Request &request) override {
+    if (free_slots_.empty()) return false;
+    const unsigned int tail = *sq_tail_;
+    if (tail - __atomic_load_n(sq_head_, __ATOMIC_ACQUIRE) >= sq_entries_) return false;
+    const unsigned int slot_index = free_slots_.back();
+    free_slots_.pop_back();
+    Slot &slot = slots_[slot_index];
+    slot.iov.iov_base = request.buf;
+    slot.iov.iov_len = request.length;
+    slot.user_data = request.user_data;
+    slot.write = request.write;
+    // IORING_OP_READV/WRITEV are the oldest opcodes (Linux 5.1)
+    const unsigned int index = tail & sq_mask_;
+    io_uring_sqe *sqe = &sqes_[index];
+    ::memset(sqe, 0, sizeof(*sqe));
+    sqe->opcode = request.write ? IORING_OP_WRITEV : IORING_OP_READV;
+    sqe->fd = request.fd;
+    sqe->off = request.offset;
+    sqe->addr = reinterpret_cast<unsigned long>(&slot.iov);
+    sqe->len = 1;
+    sqe->user_data = slot_index;
+    sq_array_[index] = index;
+    __atomic_store_n(sq_tail_, tail + 1, __ATOMIC_RELEASE);
+    ++to_submit_;
+    ++in_flight_;
+    return true;
+  }
+
+  size_t Wait(std::vector<Completion> *completions) override {
+    if (in_flight_ == 0) return 0;
+    // the queued requests are always sent even if some have completed
+    size_t count = Reap(completions);
+    while (to_submit_ != 0 || count == 0) {
+      const unsigned int min_complete = (count == 0) ? 1 : 0;
+      const int ret = static_cast<int>(
+          ::syscall(__NR_io_uring_enter, ring_fd_, to_submit_, min_complete,
+                    min_complete ? IORING_ENTER_GETEVENTS : 0, nullptr, 0));
+      mlib::Stats::GetInstance().Add(mlib::Stats::kSyscalls);
+      if (ret < 0) {
+        if (errno == EINTR || errno == EAGAIN || errno == EBUSY) continue;
+        std::cerr << "[Error] IoEngine: io_uring_enter() failed. ("
+                  << ::strerror(errno) << ")" << std::endl;
+        return count;
+      }
+      to_submit_ -= std::min(to_submit_, static_cast<unsigned int>(ret));
+      count += Reap(completions);
+    }
+    return count;
+  }
+
+  unsigned int GetInFlightCount() const noexcept override {
+    return in_flight_;
+  }
+
+private:
+  struct Slot {
+    struct iovec iov;
+    void *user_data;
+    bool write;
+  };
+
+  size_t Reap(std::vector<Completion> *completions) {
+    unsigned int head = *cq_head_;
+    const unsigned int tail = __atomic_load_n(cq_tail_, __ATOMIC_ACQUIRE);
+    size_t count = 0;
+    for (; head != tail; ++head, ++count) {
+      const io_uring_cqe &cqe = cqes_[head & cq_mask_];
+      const unsigned int slot_index = static_cast<unsigned int>(cqe.user_data);
+      const Slot &slot = slots_[slot_index];
+      if (!slot.write && cqe.res > 0) {
+        mlib::Stats::GetInstance().Add(mlib::Stats::kBytesRead, cqe.res);
+      }
+      completions->push_back({ slot.user_data, cqe.res });
+      free_slots_.push_back(slot_index);
+    }
+    __atomic_store_n(cq_head_, head, __ATOMIC_RELEASE);
+    in_flight_ -= count;
+    return count;
+  }
+
+  int ring_fd_;
+  void *sq_ring_;
+  void *cq_ring_;
+  io_uring_sqe *sqes_;
+  size_t sq_ring_size_;
+  size_t cq_ring_size_;
+  unsigned int sq_entries_;
+  unsigned int *sq_head_;
+  unsigned int *sq_tail_;
+  unsigned int sq_mask_;
+  unsigned int *sq_array_;
+  unsigned int *cq_head_;
+  unsigned int *cq_tail_;
+  unsigned int cq_mask_;
+  io_uring_cqe *cqes_;
+  unsigned int to_submit_;
+  unsigned int in_flight_;
+  std::vector<Slot> slots_;
+  std::vector<unsigned int> free_slots_;
+};
+
+#endif // MLIB_HAVE_IO_URING
+
+} // namespace
+
+namespace mlib {
+
+IoEngine *IoEngine::Create(unsigned int queue_depth, bool use_uring) {
+  queue_depth = std::max(1U, std::min(queue_depth, 4096U));
+#ifdef MLIB_HAVE_IO_URING
+  if (use_uring) {
+    UringEngine *engine = new UringEngine(queue_depth);
+    if (engine->IsOpen()) {
+      return engine;
+    }
+    delete engine;
+    std::cout << "[Info] IoEngine: io_uring is not available. "
+              << "Use a thread pool instead." << std::endl;
+  }
+#else
+  (void)use_uring;
+#endif
+  return new ThreadPoolEngine(queue_depth);
+}
+
+} // namespace mlib
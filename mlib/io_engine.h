@@ -0,0 +1,94 @@
+#pragma once
+
+/* io_engine.h (updated on 2018/05/08)
+ * Copyright (C) 2018 renny1398.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ */
+
+#include <sys/types.h>
+#include <vector>
+
+namespace mlib {
+
+////////////////////////////////////////////////////////////////////////
+/// @brief IoEngine interface class
+///
+/// An asynchronous positional read/write queue. Requests are queued with
+/// Submit() and handed to the kernel at once in Wait(), which returns the
+/// requests that have completed in any order. The io_uring(7) backend is
+/// used on Linux if available, and a thread pool of pread(2)/pwrite(2)
+/// otherwise. An engine must be used by one thread.
+////////////////////////////////////////////////////////////////////////
+
+class IoEngine {
+public:
+  struct Request {
+    int fd;
+    char *buf;
+    size_t length;
+    off_t offset;
+    bool write;
+    void *user_data;
+  };
+
+  struct Completion {
+    void *user_data;
+    ssize_t result;  // transferred bytes, or a negative errno value
+  };
+
+  /**
+   * @brief A factory method of an I/O engine.
+   * @param[in] queue_depth the maximum count of requests in flight.
+   * @param[in] use_uring false not to try io_uring.
+   * @return a pointer to a created engine. It is never a null pointer.
+   */
+  static IoEngine *Create(unsigned int queue_depth, bool use_uring = true);
+
+  virtual ~IoEngine() = default;
+
+  /**
+   * @brief Returns the name of this backend ("io_uring" or "threads").
+   */
+  virtual const char *name() const noexcept = 0;
+
+  /**
+   * @brief Queue a request.
+   * @return true if queued, and false if the queue is full.
+   */
+  virtual bool Submit(const Request &request) = 0;
+
+  /**
+   * @brief Send the queued requests and wait for at least one completion.
+   * @param[out] completions the completed requests are appended to it.
+   * @return the count of the appended completions, or 0 if no request is in flight.
+   */
+  virtual size_t Wait(std::vector<Completion> *completions) = 0;
+
+  /**
+   * @brief Returns the count of the requests which have not completed yet.
+   */
+  virtual unsigned int GetInFlightCount() const noexcept = 0;
+
+  unsigned int queue_depth() const noexcept { return queue_depth_; }
+
+protected:
+  explicit IoEngine(unsigned int queue_depth) : queue_depth_(queue_depth) {}
+
+private:
+  const unsigned int queue_depth_;
+};
+
+} // namespace mlib
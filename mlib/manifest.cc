@@ -0,0 +1,258 @@
+/* manifest.cc (updated on 2018/05/22)
+ * Copyright (C) 2018 renny1398.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ */
+
+#include <sys/types.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <algorithm>
+#include <atomic>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include "mlib.h"
+#include "reader.h"
+#include "xxhash.h"
+#include "manifest.h"
+
+namespace {
+
+// the unit of reading a file to hash
+const size_t kChunkSize = 1024 * 1024;
+
+// a version of a file to hash
+struct HashJob {
+  size_t entry;                     // the index in the entries
+  std::shared_ptr<mlib::Reader> reader;  // null for an OS file
+  std::string os_path;
+};
+
+void collect(mlib::VersionedEntry *entry, const std::string &path,
+             std::vector<mlib::ManifestEntry> *entries, std::vector<HashJob> *jobs) {
+  if (entry->IsDirectory()) {
+    std::vector<mlib::VersionedEntry*> children = entry->GetChildren();
+    for (auto &p_child : children) {
+      const std::string child_name = p_child->GetName();
+      collect(p_child, path.empty() ? child_name : path + '/' + child_name, entries, jobs);
+      delete p_child;
+    }
+    return;
+  }
+  const int current = entry->GetCurrentVersion();
+  const int latest = entry->GetLatestVersion();
+  for (int version = 1; version <= latest; ++version) {
+    entry->SwitchVersion(version);
+    if ( !entry->IsFile() ) continue;
+    mlib::ManifestEntry e;
+    e.path = path;
+    e.version = version;
+    e.hash = 0;
+    e.change = mlib::ManifestEntry::kAdded;
+    HashJob job;
+    job.entry = entries->size();
+    const mlib::MLib *p_mlib = entry->GetCurrentMLib();
+    if (p_mlib) {
+      e.archive = p_mlib->libname();
+      e.size = p_mlib->GetSize();
+      e.offset = p_mlib->GetBaseOffset();
+      job.reader = p_mlib->reader();
+    } else {
+      e.size = entry->GetSize();
+      e.offset = 0;
+      job.os_path = entry->GetFullPath();
+    }
+    entries->push_back(std::move(e));
+    jobs->push_back(std::move(job));
+  }
+  entry->SwitchVersion(current);
+}
+
+bool hash_job(const HashJob &job, mlib::ManifestEntry *e, char *buf) {
+  mlib::XXH64 state;
+  if (job.reader) {
+    const char *view = job.reader->GetView(e->offset, e->size);
+    if (view) {
+      e->hash = mlib::XXH64::Hash(view, e->size);
+      return true;
+    }
+    for (uint64_t pos = 0; pos < e->size; ) {
+      const size_t length = static_cast<size_t>(std::min<uint64_t>(kChunkSize, e->size - pos));
+      if (job.reader->Read(e->offset + pos, length, buf) != length) return false;
+      state.Update(buf, length);
+      pos += length;
+    }
+  } else {
+    const int fd = ::open(job.os_path.c_str(), O_RDONLY);
+    if (fd == -1) return false;
+    for (uint64_t pos = 0; pos < e->size; ) {
+      const size_t length = static_cast<size_t>(std::min<uint64_t>(kChunkSize, e->size - pos));
+      const ssize_t read_bytes = ::pread(fd, buf, length, pos);
+      if (read_bytes <= 0) {
+        ::close(fd);
+        return false;
+      }
+      state.Update(buf, read_bytes);
+      pos += read_bytes;
+    }
+    ::close(fd);
+  }
+  e->hash = state.Digest();
+  return true;
+}
+
+const char *change_name(mlib::ManifestEntry::Change change) {
+  switch (change) {
+  case mlib::ManifestEntry::kAdded:
+    return "added";
+  case mlib::ManifestEntry::kModified:
+    return "modified";
+  default:
+    return "unchanged";
+  }
+}
+
+} // namespace
+
+namespace mlib {
+
+bool Manifest::Build(VersionedEntry *root) {
+  entries_.clear();
+  if (root == nullptr || !root->IsOpen()) return false;
+  std::vector<HashJob> jobs;
+  collect(root, root->IsDirectory() ? std::string() : root->GetName(), &entries_, &jobs);
+
+  // hash the files in the order of their contents in the libraries
+  std::sort(jobs.begin(), jobs.end(), [this](const HashJob &lhs, const HashJob &rhs) {
+    if (lhs.reader != rhs.reader) {
+      return std::less<Reader*>()(lhs.reader.get(), rhs.reader.get());
+    }
+    if (lhs.reader) return entries_[lhs.entry].offset < entries_[rhs.entry].offset;
+    return lhs.os_path < rhs.os_path;
+  });
+  unsigned int thread_count = jobs_;
+  if (thread_count == 0) {
+    thread_count = std::max(1U, std::thread::hardware_concurrency());
+  }
+  thread_count = static_cast<unsigned int>(std::min<size_t>(thread_count, jobs.size()));
+  std::atomic<size_t> next_job(0);
+  std::atomic<bool> ret(true);
+  std::mutex error_mutex;
+  auto worker = [&]() {
+    std::vector<char> buf(kChunkSize);
+    for (size_t i = next_job++; i < jobs.size(); i = next_job++) {
+      ManifestEntry &e = entries_[jobs[i].entry];
+      if (hash_job(jobs[i], &e, &buf[0])) continue;
+      ret = false;
+      std::lock_guard<std::mutex> lock(error_mutex);
+      std::cerr << "[Error] Manifest: failed to read '" << e.path
+                << "' (version " << e.version << ")." << std::endl;
+    }
+  };
+  std::vector<std::thread> threads;
+  for (unsigned int i = 1; i < thread_count; ++i) {
+    threads.emplace_back(worker);
+  }
+  worker();
+  for (auto &thread : threads) {
+    thread.join();
+  }
+
+  // the versions of a path are next to each other, the oldest first
+  for (size_t i = 1; i < entries_.size(); ++i) {
+    const ManifestEntry &prev = entries_[i - 1];
+    ManifestEntry &e = entries_[i];
+    if (prev.path != e.path) continue;
+    const bool same = (prev.size == e.size && prev.hash == e.hash);
+    e.change = same ? ManifestEntry::kUnchanged : ManifestEntry::kModified;
+  }
+  return ret;
+}
+
+void Manifest::Write(std::ostream &os) const {
+  const auto flags = os.flags();
+  const auto fill = os.fill('0');
+  os << "# path\tversion\tarchive\tsize\toffset\txxh64\tchange\n";
+  for (const auto &e : entries_) {
+    os << e.path << '\t' << e.version << '\t' << e.archive << '\t'
+       << std::dec << e.size << '\t' << e.offset << '\t'
+       << std::hex << std::setw(16) << e.hash << std::dec << '\t'
+       << change_name(e.change) << '\n';
+  }
+  os.fill(fill);
+  os.flags(flags);
+  os.flush();
+}
+
+void Manifest::PrintChanges(std::ostream &os) const {
+  struct Changes {
+    std::vector<const ManifestEntry*> changed;
+    size_t added;
+    size_t modified;
+    size_t unchanged;
+    Changes() : added(0), modified(0), unchanged(0) {}
+  };
+  std::map<std::string, Changes> changes_map;
+  for (const auto &e : entries_) {
+    Changes &changes = changes_map[e.archive];
+    switch (e.change) {
+    case ManifestEntry::kAdded:
+      ++changes.added;
+      changes.changed.push_back(&e);
+      break;
+    case ManifestEntry::kModified:
+      ++changes.modified;
+      changes.changed.push_back(&e);
+      break;
+    default:
+      ++changes.unchanged;
+      break;
+    }
+  }
+  for (const auto &item : changes_map) {
+    const Changes &changes = item.second;
+    os << (item.first.empty() ? "(OS files)" : item.first) << ": "
+       << changes.added << " added, " << changes.modified << " modified, "
+       << changes.unchanged << " unchanged\n";
+    for (const auto *e : changes.changed) {
+      os << "  " << ((e->change == ManifestEntry::kAdded) ? '+' : '*')
+         << ' ' << e->path << '\n';
+    }
+  }
+  os.flush();
+}
+
+std::vector< std::vector<const ManifestEntry*> > Manifest::GetDuplicates() const {
+  std::map< std::pair<uint64_t, uint64_t>, std::vector<const ManifestEntry*> > groups;
+  for (size_t i = 0; i < entries_.size(); ++i) {
+    const ManifestEntry &e = entries_[i];
+    const bool latest = (i + 1 == entries_.size() || entries_[i + 1].path != e.path);
+    if ( !latest || e.size == 0 ) continue;
+    groups[std::make_pair(e.size, e.hash)].push_back(&e);
+  }
+  std::vector< std::vector<const ManifestEntry*> > ret;
+  for (auto &group : groups) {
+    if (group.second.size() < 2) continue;
+    ret.push_back(std::move(group.second));
+  }
+  return ret;
+}
+
+} // namespace mlib
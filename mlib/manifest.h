@@ -0,0 +1,100 @@
+#pragma once
+
+/* manifest.h (updated on 2018/05/22)
+ * Copyright (C) 2018 renny1398.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ */
+
+#include <stdint.h>
+#include <ostream>
+#include <string>
+#include <vector>
+
+namespace mlib {
+
+class VersionedEntry;
+
+////////////////////////////////////////////////////////////////////////
+/// @brief ManifestEntry struct
+///
+/// A version of a file in a manifest.
+////////////////////////////////////////////////////////////////////////
+
+struct ManifestEntry {
+  enum Change { kAdded, kModified, kUnchanged };
+
+  std::string path;     // '/'-separated, relative to the root of the manifest
+  int version;          // the version of the versioned entry (1 is the oldest)
+  std::string archive;  // the library filename, or empty for an OS file
+  uint64_t size;
+  int64_t offset;       // the offset of the contents in the library
+  uint64_t hash;        // the XXH64 of the contents
+  Change change;        // compared with the previous version of the same path
+};
+
+////////////////////////////////////////////////////////////////////////
+/// @brief Manifest class
+///
+/// The contents hashes of every version of every file under a versioned
+/// entry (data.dat to data9.dat, .lib and the OS files). The files are
+/// hashed on several threads in the order of their contents in the
+/// libraries.
+////////////////////////////////////////////////////////////////////////
+
+class Manifest {
+public:
+  Manifest() : jobs_(0) {}
+
+  /**
+   * @brief Set the count of threads to hash (default: the number of CPUs).
+   */
+  void SetJobs(unsigned int jobs) noexcept { jobs_ = jobs; }
+
+  /**
+   * @brief Hash all files under a versioned entry.
+   * @param[in] root a versioned directory or file.
+   * @return true if every file was read, and false otherwise.
+   */
+  bool Build(VersionedEntry *root);
+
+  /**
+   * @brief Returns the entries ordered by path and version.
+   */
+  const std::vector<ManifestEntry> &entries() const noexcept { return entries_; }
+
+  /**
+   * @brief Write the entries as tab-separated values.
+   */
+  void Write(std::ostream &os) const;
+
+  /**
+   * @brief Print the files which each library adds or modifies, and the
+   *        count of the files which it stores again without a change.
+   */
+  void PrintChanges(std::ostream &os) const;
+
+  /**
+   * @brief Returns the groups of the latest versions which have the same
+   *        contents at different paths. Empty files are not grouped.
+   */
+  std::vector< std::vector<const ManifestEntry*> > GetDuplicates() const;
+
+private:
+  unsigned int jobs_;
+  std::vector<ManifestEntry> entries_;
+};
+
+} // namespace mlib
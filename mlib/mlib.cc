@@ -21,103 +21,595 @@
 #include <fcntl.h>
 #include <unistd.h>
 #include <dirent.h>
+#include <sys/mman.h>
 #include <cassert>
 #include <ctime>
 #include <cmath>
+#include <cstring>
 #include <iostream>
 #include <iomanip>
 #include <algorithm>
 #include <sstream>
 #include <fstream>
+#include <list>
 #include <map>
+#include <unordered_map>
+#include <mutex>
+#include <functional>
+#include <future>
+#include <thread>
+#include <atomic>
 #include <locale>
 #include <codecvt>
 #include <stdexcept>
-#include <regex>
+#include "fnv1a.h"
 #include "mlib.h"
+#include "overlay_index.h"
 #include "reader.h"
+#include "shadow_cache.h"
+#include "stats.h"
 
 namespace {
 
 std::map<std::string, mlib::KeyInfo> key_info_;
 
-std::string relpath2abspath(const std::string& relpath) {
-  std::string abspath;
-  std::string curr_relpath;
+// the version of the index file format (see MLIDX_t)
+const uint32_t kIndexVersion = 1;
+
+// a hash of how a product decodes and lays out archives (see MLIDX_t)
+uint64_t index_key_hash(const std::string &product) {
+  const mlib::KeyInfo *kinfo;
+  if (mlib::FindKeyInfo(product, &kinfo) == false) return mlib::kFnv1aOffsetBasis;
+  unsigned char bytes[24];
+  const int cipher_type = kinfo->cipher_type();
+  const unsigned int data_alignment = kinfo->data_alignment();
+  ::memcpy(bytes, kinfo->key_string(), 16);
+  ::memcpy(bytes + 16, &cipher_type, 4);
+  ::memcpy(bytes + 20, &data_alignment, 4);
+  return mlib::Fnv1a(mlib::kFnv1aOffsetBasis, bytes, sizeof(bytes));
+}
+
+// the working directory. it is read every time, since a caller may chdir(2).
+std::string current_directory() {
+  char* buf = ::getcwd(nullptr, 0);
+  const std::string ret(buf ? buf : "");
+  ::free(buf);
+  return ret;
+}
+
+// the separators of path names which the utilities below accept
+const char kPathDelims[] = "\\/";
+
+inline bool is_path_delim(char c) {
+  return c == '/' || c == '\\';
+}
+
+// the length of the root of an absolute path ("/" or "C:\"), or 0 if relative
+size_t root_length(const std::string& path) {
 #ifdef _WINDOWS
-  static std::regex re_root("^(?:[A-Za-z]:)?[\\\\/]");
+  size_t i = 0;
+  if (path.size() >= 2 && path[1] == ':' &&
+      (('A' <= path[0] && path[0] <= 'Z') || ('a' <= path[0] && path[0] <= 'z'))) {
+    i = 2;
+  }
+  return (i < path.size() && is_path_delim(path[i])) ? i + 1 : 0;
 #else
-  static std::regex re_root("^/");
+  return (!path.empty() && path[0] == '/') ? 1 : 0;
 #endif
-  std::smatch match;
-  if (relpath.empty() || !std::regex_search(relpath, match, re_root)) {
-    char* cwd = ::getcwd(nullptr, 0);
+}
+
+// the name after the last delimiter, or an empty string without delimiters
+std::string path_name(const std::string& path) {
+  const size_t pos = path.find_last_of(kPathDelims);
+  return (pos == std::string::npos) ? std::string() : path.substr(pos + 1);
+}
+
+// the path up to and including the last delimiter
+std::string path_location(const std::string& path) {
+  const size_t pos = path.find_last_of(kPathDelims);
+  return (pos == std::string::npos) ? std::string() : path.substr(0, pos + 1);
+}
+
+std::string relpath2abspath(const std::string& relpath) {
+  std::string abspath;
+  size_t pos = root_length(relpath);
+  if (pos == 0) {
+    const std::string cwd = current_directory();
+    abspath.reserve(cwd.size() + 1 + relpath.size());
     abspath.assign(cwd);
-    ::free(cwd);    
     abspath.append(1, mlib::kPathDelim);
-    curr_relpath = relpath;
   } else {
-    abspath = match.str();
-    curr_relpath = relpath.substr(abspath.length(), std::string::npos);
-  }
-  while ( !curr_relpath.empty() ) {
-    static std::regex re_child("^([^\\\\/]+)(?:[\\\\/]|$)");
-    static std::regex re_abs_parent("^(.*[\\\\/])[^\\\\/]+[\\\\/]?$");
-    if (!std::regex_search(curr_relpath, match, re_child)) {
-      return std::string();
-    }
-    if (match[1].str() == "..") {
-      curr_relpath.erase(0, match.str().length());
-      if (!std::regex_match(abspath, match, re_abs_parent)) {
-        return std::string();
-      }
-      abspath = match[1].str();
-    } else if (match[1].str() == ".") {
-      curr_relpath.erase(0, match.str().length());
-    } else {
-      abspath.append(match.str());
-      curr_relpath.erase(0, match.str().length());
+    abspath.assign(relpath, 0, pos);
+  }
+  const size_t abs_root_length = root_length(abspath);
+  while (pos < relpath.size()) {
+    size_t end = relpath.find_first_of(kPathDelims, pos);
+    const bool has_delim = (end != std::string::npos);
+    if ( !has_delim ) end = relpath.size();
+    const size_t length = end - pos;
+    if (length == 2 && relpath[pos] == '.' && relpath[pos + 1] == '.') {
+      // abspath ends with a delimiter here
+      if (abspath.size() <= abs_root_length) return std::string();
+      const size_t parent = abspath.find_last_of(kPathDelims, abspath.size() - 2);
+      if (parent == std::string::npos) return std::string();
+      abspath.erase(parent + 1);
+    } else if ( !(length == 1 && relpath[pos] == '.') && length != 0 ) {
+      abspath.append(relpath, pos, has_delim ? length + 1 : length);
     }
+    pos = has_delim ? end + 1 : end;
   }
   std::replace(abspath.begin(), abspath.end(),
                mlib::kPathDelimNotUsed, mlib::kPathDelim);
   return abspath;
 }
 
+// the size and the mtime of a file, which tell whether an open archive
+// is still the file (e.g. not overwritten in place)
+struct FileStamp {
+  bool exists;
+  off_t size;
+  struct timespec mtime;
+
+  bool operator==(const FileStamp &rhs) const {
+    if (exists != rhs.exists) return false;
+    return !exists || (size == rhs.size && mtime.tv_sec == rhs.mtime.tv_sec &&
+                       mtime.tv_nsec == rhs.mtime.tv_nsec);
+  }
+  bool operator!=(const FileStamp &rhs) const { return !(*this == rhs); }
+};
+
+FileStamp stamp_file(const std::string &filename) {
+  FileStamp stamp = {};
+  struct stat st;
+  stamp.exists = (::stat(filename.c_str(), &st) == 0);
+  if (stamp.exists) {
+    stamp.size = st.st_size;
+    stamp.mtime = st.st_mtim;
+  }
+  return stamp;
+}
+
+// the archive sets in directories. A set "data" has up to 20 members:
+// data.dat, data1.dat, ..., data9.dat, data.lib, data1.lib, ..., data9.lib.
+// A directory is scanned once and again only when its mtime changes, and
+// the members of a set are opened once per product and kept open until
+// the size or the mtime of one of them changes (e.g. overwritten in place,
+// which leaves the mtime of the directory as it is).
+class ArchiveSetCache {
+public:
+  static ArchiveSetCache &GetInstance() {
+    static ArchiveSetCache instance;
+    return instance;
+  }
+
+  // open the members of a set, data9.dat to data.dat and then data9.lib
+  // to data.lib. path is the directory and the set name ("dir/data").
+  std::vector<mlib::MLibPtr> Open(const std::string &path, const std::string &product);
+
+  // the overlay index of the layers of a set, built once per product.
+  // layers are the members which Open() returned, or their children of the set name.
+  std::shared_ptr<const mlib::OverlayIndex> GetOverlay(const std::string &path, const std::string &product,
+                                                       const std::vector<mlib::MLibPtr> &layers);
+
+  void Clear() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    directories_.clear();
+  }
+
+private:
+  struct OpenedSet {
+    // all files of the set, also the ones which failed to open
+    std::vector< std::pair<std::string, FileStamp> > files;
+    std::vector<mlib::MLibPtr> members;
+  };
+  struct Directory {
+    struct timespec mtime;
+    std::map<std::string, unsigned int> sets;  // set names to the bits (10 * ext + digit)
+    // (set name, product) to the open members
+    std::map< std::pair<std::string, std::string>, OpenedSet > opened;
+    std::map< std::pair<std::string, std::string>, std::shared_ptr<const mlib::OverlayIndex> > overlays;
+  };
+
+  ArchiveSetCache() = default;
+  static void Scan(const std::string &dir, Directory *directory);
+  static void SplitPath(const std::string &path, std::string *dir, std::string *set_name);
+  static bool IsChanged(const OpenedSet &set);
+
+  std::mutex mutex_;
+  std::map<std::string, Directory> directories_;
+};
+
+void ArchiveSetCache::Scan(const std::string &dir, Directory *directory) {
+  static const char *ext[2] = { ".dat", ".lib" };
+  directory->sets.clear();
+  directory->opened.clear();
+  directory->overlays.clear();
+  DIR *dirp = ::opendir(dir.c_str());
+  if (dirp == nullptr) return;
+  while (struct dirent *dent = ::readdir(dirp)) {
+    const std::string name(dent->d_name);
+    if (name.size() <= 4) continue;
+    const std::string stem(name, 0, name.size() - 4);
+    for (int i = 0; i < 2; ++i) {
+      if (name.compare(stem.size(), 4, ext[i]) != 0) continue;
+      // "data1.dat" is the member 1 of "data" and the member 0 of "data1"
+      directory->sets[stem] |= 1U << (10 * i);
+      const char c = stem.back();
+      if ('1' <= c && c <= '9' && stem.size() > 1) {
+        directory->sets[stem.substr(0, stem.size() - 1)] |= 1U << (10 * i + (c - '0'));
+      }
+    }
+  }
+  ::closedir(dirp);
+}
+
+void ArchiveSetCache::SplitPath(const std::string &path, std::string *dir, std::string *set_name) {
+  const auto delim_pos = path.find_last_of(mlib::kPathDelim);
+  *dir = (delim_pos == std::string::npos) ? std::string(".") :
+         (delim_pos == 0) ? std::string(1, mlib::kPathDelim) : path.substr(0, delim_pos);
+  *set_name = (delim_pos == std::string::npos) ? path : path.substr(delim_pos + 1);
+}
+
+bool ArchiveSetCache::IsChanged(const OpenedSet &set) {
+  for (const auto &file : set.files) {
+    if (stamp_file(file.first) != file.second) return true;
+  }
+  return false;
+}
+
+std::vector<mlib::MLibPtr> ArchiveSetCache::Open(const std::string &path, const std::string &product) {
+  static const char *ext[2] = { ".dat", ".lib" };
+  std::string dir, set_name;
+  SplitPath(path, &dir, &set_name);
+  const auto key = std::make_pair(set_name, product);
+  struct stat st;
+  std::vector<std::string> filenames;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (::stat(dir.c_str(), &st) != 0 || !S_ISDIR(st.st_mode)) {
+      directories_.erase(dir);
+      return std::vector<mlib::MLibPtr>();
+    }
+    auto it = directories_.find(dir);
+    if (it == directories_.end() ||
+        it->second.mtime.tv_sec != st.st_mtim.tv_sec ||
+        it->second.mtime.tv_nsec != st.st_mtim.tv_nsec) {
+      Directory &directory = directories_[dir];
+      directory.mtime = st.st_mtim;
+      Scan(dir, &directory);
+      it = directories_.find(dir);
+    }
+    Directory &directory = it->second;
+    const auto opened = directory.opened.find(key);
+    if (opened != directory.opened.end()) {
+      if ( !IsChanged(opened->second) ) return opened->second.members;
+      directory.opened.erase(opened);
+      directory.overlays.erase(key);
+    }
+    const auto set = directory.sets.find(set_name);
+    if (set == directory.sets.end()) return std::vector<mlib::MLibPtr>();
+    for (int i = 0; i < 2; ++i) {
+      for (int j = 9; 0 <= j; --j) {
+        if ((set->second & (1U << (10 * i + j))) == 0) continue;
+        std::string filename(path);
+        if (j != 0) filename.append(1, static_cast<char>('0' + j));
+        filename.append(ext[i]);
+        filenames.push_back(std::move(filename));
+      }
+    }
+  }
+
+  // the status is taken before opening, so a change during the open is
+  // found by the next call
+  OpenedSet opened_set;
+  for (const auto &filename : filenames) {
+    opened_set.files.emplace_back(filename, stamp_file(filename));
+  }
+
+  // open the members concurrently. the futures of std::async wait for their
+  // threads when destroyed, so an exception from any of them reaches the caller
+  // after all of them have finished.
+  std::vector<mlib::MLibPtr> members(filenames.size());
+  std::vector< std::future<mlib::MLibPtr> > futures;
+  futures.reserve(filenames.size());
+  for (size_t i = 1; i < filenames.size(); ++i) {
+    futures.push_back(std::async(std::launch::async, &mlib::MLib::Open,
+                                 std::cref(filenames[i]), std::cref(product)));
+  }
+  members[0] = mlib::MLib::Open(filenames[0], product);
+  for (size_t i = 1; i < filenames.size(); ++i) {
+    members[i] = futures[i - 1].get();
+  }
+  members.erase(std::remove(members.begin(), members.end(), nullptr), members.end());
+
+  std::lock_guard<std::mutex> lock(mutex_);
+  const auto it = directories_.find(dir);
+  // keep them unless the directory has changed in the meantime
+  if (it != directories_.end() &&
+      it->second.mtime.tv_sec == st.st_mtim.tv_sec &&
+      it->second.mtime.tv_nsec == st.st_mtim.tv_nsec) {
+    opened_set.members = members;
+    it->second.opened[key] = std::move(opened_set);
+  }
+  return members;
+}
+
+std::shared_ptr<const mlib::OverlayIndex> ArchiveSetCache::GetOverlay(
+    const std::string &path, const std::string &product, const std::vector<mlib::MLibPtr> &layers) {
+  std::string dir, set_name;
+  SplitPath(path, &dir, &set_name);
+  const auto key = std::make_pair(set_name, product);
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    const auto it = directories_.find(dir);
+    if (it != directories_.end()) {
+      const auto overlay = it->second.overlays.find(key);
+      if (overlay != it->second.overlays.end()) return overlay->second;
+    }
+  }
+  // build it without the lock. a set is rarely built twice at once,
+  // and then the first one is kept.
+  const auto overlay = mlib::OverlayIndex::Build(layers);
+  std::lock_guard<std::mutex> lock(mutex_);
+  const auto it = directories_.find(dir);
+  // keep it while the members are kept
+  if (it == directories_.end() || it->second.opened.count(key) == 0) return overlay;
+  return it->second.overlays.insert(std::make_pair(key, overlay)).first->second;
+}
+
+// the versions of an entry in an archive set, the latest first.
+// if overlay is given and the entry is a directory, it is set to the
+// overlay index of the set.
 std::vector<mlib::MLibPtr> GetMLibEntryHistory(const std::string& mlib_name,
                                                const std::string& product,
-                                               const std::string& mlib_internal_path) {
-  static const char *ext[2] = { ".dat", ".lib" };
+                                               const std::string& mlib_internal_path,
+                                               std::shared_ptr<const mlib::OverlayIndex> *overlay = nullptr) {
   std::vector<mlib::MLibPtr> mlib_entries;
-  mlib_entries.reserve(20); // data.dat, data1.dat, ..., data9.dat, data.lib, data1.lib, ... data9.lib
+  const auto delim_pos = mlib_name.find_last_of(mlib::kPathDelim, std::string::npos);
   const auto ext_pos = mlib_name.find_last_of('.', std::string::npos);
+  const bool has_ext = (ext_pos != std::string::npos &&
+                        (delim_pos == std::string::npos || delim_pos < ext_pos));
   const std::string mlib_name_without_ext =
-      (ext_pos == std::string::npos) ? mlib_name : mlib_name.substr(0, ext_pos);
-  const auto delim_pos = mlib_name_without_ext.find_last_of(mlib::kPathDelim, std::string::npos);
+      has_ext ? mlib_name.substr(0, ext_pos) : mlib_name;
   const std::string name =
       (delim_pos == std::string::npos) ? mlib_name_without_ext : mlib_name_without_ext.substr(delim_pos + 1);
-  std::string fixed_mlib_name;
-  for (int i = 0; i < 2; ++i) { // { 0 : ".dat", 1 : ".lib" }
-    for (char j = '9'; '0' <= j; --j) {
-      fixed_mlib_name.assign(mlib_name_without_ext);
-      if (j != '0') fixed_mlib_name.append(1, j);
-      fixed_mlib_name.append(ext[i]);
-      // std::cout << "[Info] OpenMLib(" << fixed_mlib_name << ", " << product << ")." << std::endl;
-      mlib::MLibPtr p_mlib_base = mlib::MLib::Open(fixed_mlib_name, product);
-      if (nullptr == p_mlib_base) continue;
-      // std::cout << "[Info] p_mlib_base->Child(" << name << ")." << std::endl;
-      mlib::MLibPtr p_mlib = p_mlib_base->Child(name);
-      if (nullptr == p_mlib) p_mlib = p_mlib_base;
-      // std::cout << "[Info] p_mlib->GetEntry(" << mlib_internal_path << ")." << std::endl;
-      p_mlib = p_mlib->GetEntry(mlib_internal_path);
-      if (nullptr != p_mlib) {
-        mlib_entries.push_back(p_mlib);
-      }
+  if (name.empty()) return mlib_entries;
+  // data9.dat, ..., data.dat, data9.lib, ..., data.lib
+  ArchiveSetCache &cache = ArchiveSetCache::GetInstance();
+  std::vector<mlib::MLibPtr> layers;
+  bool has_directory = false;
+  for (const auto &p_mlib_base : cache.Open(mlib_name_without_ext, product)) {
+    mlib::MLibPtr p_layer = p_mlib_base->Child(name);
+    if (nullptr == p_layer) p_layer = p_mlib_base;
+    mlib::MLibPtr p_mlib = p_layer->GetEntry(mlib_internal_path);
+    layers.push_back(std::move(p_layer));
+    if (nullptr != p_mlib) {
+      has_directory = has_directory || p_mlib->IsDirectory();
+      mlib_entries.push_back(std::move(p_mlib));
     }
   }
+  // a directory is likely to be walked, and a file does not need the index
+  if (overlay != nullptr && has_directory) {
+    *overlay = cache.GetOverlay(mlib_name_without_ext, product, layers);
+  }
   return mlib_entries;
 }
 
+// the archive versions of paths relative to versioned entries, least
+// recently used ones dropped first. OS entries are not kept here, since
+// OSDirectory already keeps its listing until its mtime changes.
+class PathCache {
+public:
+  struct Value {
+    std::vector<mlib::MLibPtr> base;     // keeps the key pointers alive
+    std::shared_ptr<const mlib::OverlayIndex> overlay;
+    std::vector<mlib::MLibPtr> history;  // the versions of the path
+    uint32_t overlay_node;
+  };
+
+  static const size_t kDefaultCapacity = 4096;
+
+  static PathCache &GetInstance() {
+    static PathCache instance;
+    return instance;
+  }
+
+  // the key of a path relative to the versions of an entry and its overlay index
+  static std::string Key(const std::vector<mlib::MLibPtr> &base,
+                         const std::shared_ptr<const mlib::OverlayIndex> &overlay,
+                         const std::string &path) {
+    std::string key(1, static_cast<char>(base.size()));
+    key.reserve(1 + (base.size() + 1) * sizeof(void*) + 1 + path.size());
+    for (const auto &p_mlib : base) {
+      const void *p = p_mlib.get();
+      key.append(reinterpret_cast<const char*>(&p), sizeof(p));
+    }
+    const void *p = overlay.get();
+    key.append(reinterpret_cast<const char*>(&p), sizeof(p));
+    key.append(1, '\0');
+    key.append(path);
+    return key;
+  }
+
+  bool Find(const std::string &key, std::vector<mlib::MLibPtr> *history, uint32_t *overlay_node) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    const auto it = index_.find(key);
+    if (it == index_.end()) {
+      mlib::Stats::GetInstance().Add(mlib::Stats::kPathCacheMisses);
+      return false;
+    }
+    mlib::Stats::GetInstance().Add(mlib::Stats::kPathCacheHits);
+    entries_.splice(entries_.begin(), entries_, it->second);
+    *history = it->second->second.history;
+    *overlay_node = it->second->second.overlay_node;
+    return true;
+  }
+
+  void Insert(const std::string &key, Value &&value) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (capacity_ == 0) return;
+    const auto it = index_.find(key);
+    if (it != index_.end()) {
+      entries_.splice(entries_.begin(), entries_, it->second);
+      return;
+    }
+    entries_.emplace_front(key, std::move(value));
+    index_.insert(std::make_pair(key, entries_.begin()));
+    Trim();
+  }
+
+  void SetCapacity(size_t capacity) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    capacity_ = capacity;
+    Trim();
+  }
+
+  void Clear() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    index_.clear();
+    entries_.clear();
+  }
+
+private:
+  typedef std::list< std::pair<std::string, Value> > List;
+
+  PathCache() : capacity_(kDefaultCapacity) {}
+
+  void Trim() {
+    while (entries_.size() > capacity_) {
+      index_.erase(entries_.back().first);
+      entries_.pop_back();
+    }
+  }
+
+  std::mutex mutex_;
+  size_t capacity_;
+  List entries_;  // the most recently used first
+  std::unordered_map<std::string, List::iterator> index_;
+};
+
+const size_t PathCache::kDefaultCapacity;
+
+// check if a path is names separated by delimiters, without "." or ".."
+bool is_plain_path(const std::string &path) {
+  if (path.empty()) return false;
+  size_t pos = 0;
+  while (true) {
+    size_t end = path.find_first_of(kPathDelims, pos);
+    if (end == std::string::npos) end = path.size();
+    const size_t length = end - pos;
+    if (length == 0) return false;
+    if (path[pos] == '.' && (length == 1 || (length == 2 && path[pos + 1] == '.'))) return false;
+    if (end == path.size()) return true;
+    pos = end + 1;
+  }
+}
+
+// the count of entries checked by score_archive_header()
+const size_t kMaxProbedEntries = 64;
+
+unsigned int get_u32(const unsigned char *p) {
+  unsigned int value;
+  ::memcpy(&value, p, sizeof(value));
+  return value;
+}
+
+// check if a name is a NUL-terminated string of printable characters
+bool is_plausible_name(const unsigned char *name, size_t length, size_t char_size) {
+  for (size_t i = 0; i + char_size <= length; i += char_size) {
+    const unsigned int c = (char_size == 1) ? name[i] : (name[i] | (name[i + 1] << 8));
+    if (c == 0) return i != 0;
+    if (c < 0x20) return false;
+  }
+  return false;
+}
+
+// score the first bytes of a decoded archive.
+// returns 0 if the signature does not match, and otherwise 1 plus the count of
+// plausible header fields and entries.
+unsigned int score_archive_header(const unsigned char *buf, size_t length,
+                                  size_t file_size, std::string *format) {
+  if (length < 16 || ::memcmp(buf, "LIB", 3) != 0) return 0;
+  unsigned int score = 1;
+  if (buf[3] == '\0' || buf[3] == 'U') {
+    const bool utf16 = (buf[3] == 'U');
+    format->assign(utf16 ? "LIBU" : "LIB");
+    const size_t name_length = utf16 ? 66 : 36;
+    const size_t entry_size = utf16 ? 80 : 48;
+    const size_t entry_count = get_u32(buf + 8);
+    const size_t entries_end = 16 + entry_count * entry_size;
+    if (entry_count == 0 || file_size < entries_end) return score;
+    ++score;
+    for (size_t i = 0; i < entry_count && i < kMaxProbedEntries; ++i) {
+      const unsigned char *entry = buf + 16 + i * entry_size;
+      if (length < 16 + (i + 1) * entry_size) break;
+      const size_t entry_length = get_u32(entry + name_length + (utf16 ? 2 : 0));
+      const size_t entry_offset = get_u32(entry + name_length + (utf16 ? 6 : 4));
+      if (is_plausible_name(entry, name_length, utf16 ? 2 : 1) &&
+          entries_end <= entry_offset && entry_offset + entry_length <= file_size) {
+        ++score;
+      }
+    }
+  } else if (buf[3] == 'P') {
+    format->assign("LIBP");
+    const size_t entry_count = get_u32(buf + 4);
+    const size_t file_count = get_u32(buf + 8);
+    if (entry_count == 0 || entry_count < file_count ||
+        file_size < 16 + entry_count * 32 + file_count * 4) return score;
+    ++score;
+    for (size_t i = 0; i < entry_count && i < kMaxProbedEntries; ++i) {
+      const unsigned char *entry = buf + 16 + i * 32;
+      if (length < 16 + (i + 1) * 32) break;
+      const unsigned int flags = get_u32(entry + 20);
+      const size_t offset_index = get_u32(entry + 24);
+      const size_t entry_length = get_u32(entry + 28);
+      const bool plausible_range = (flags & 0x30000) ?
+          (offset_index < file_count && entry_length <= file_size) :
+          (offset_index + entry_length <= entry_count);
+      if (is_plausible_name(entry, 20, 1) && plausible_range) {
+        ++score;
+      }
+    }
+  } else {
+    return 0;
+  }
+  return score;
+}
+
+
+// fill an entry table with a LIB or LIBU tree in breadth-first order.
+// an entry is a directory if its contents begin with the signature.
+template <class Header, class LibEntry, class NameFunc>
+void fill_lib_entry_table(mlib::Reader *reader, const char *signature,
+                          mlib::EntryTable *table, NameFunc get_name) {
+  table->AddNode(std::string(), false, 0, reader->GetSize());
+  for (uint32_t i = 0; i < table->size(); ++i) {
+    if (table->node(i).flags & mlib::EntryTable::Node::kFlagFile) continue;
+    const int64_t base = table->node(i).base_offset;
+    const uint64_t size = table->node(i).size;
+    Header hdr;
+    if (reader->Read(base, sizeof(hdr), &hdr) != sizeof(hdr) ||
+        size < sizeof(hdr) + sizeof(LibEntry) * static_cast<uint64_t>(hdr.entry_count)) {
+      continue;
+    }
+    std::vector<LibEntry> entries(hdr.entry_count);
+    const size_t table_size = sizeof(LibEntry) * entries.size();
+    if (!entries.empty() && reader->Read(base + sizeof(hdr), table_size, &entries[0]) != table_size) {
+      continue;
+    }
+    const uint32_t first_child = table->size();
+    for (const auto &entry : entries) {
+      const int64_t child_base = base + entry.offset;
+      char child_signature[4];
+      const bool is_file = entry.length < 4 ||
+          reader->Read(child_base, 4, child_signature) != 4 ||
+          ::memcmp(child_signature, signature, 4) != 0;
+      table->AddNode(get_name(entry), is_file, child_base, entry.length);
+    }
+    table->SetChildren(i, first_child, static_cast<uint32_t>(entries.size()));
+  }
+}
+
 } // namespace
 
 namespace mlib {
@@ -146,24 +638,115 @@ MLib::MLib(MLib *parent)
   location_.append(parent->GetName());
 }
 
-std::map< std::string, std::weak_ptr<MLib> > MLib::opened_libs_;
+namespace {
+
+struct OpenedLib {
+  std::weak_ptr<MLib> lib;
+  FileStamp stamp;  // taken before the file was opened
+};
+typedef std::map<std::string, OpenedLib> OpenedLibMap;
+
+// the libraries open in this process. The map is never changed once it is
+// published, so Open() looks a library up without a lock; an opening
+// thread publishes a new copy under the mutex.
+struct OpenedLibs {
+  std::shared_ptr<const OpenedLibMap> snapshot;
+  std::mutex mutex;
+  // the opens in progress, which other threads opening the same file wait for
+  std::map< std::string, std::shared_future<MLibPtr> > pending;
+};
+
+OpenedLibs &opened_libs() {
+  static OpenedLibs libs;
+  return libs;
+}
+
+MLibPtr find_opened_lib(const OpenedLibs &libs, const std::string &filename) {
+  const auto snapshot = std::atomic_load(&libs.snapshot);
+  if (snapshot == nullptr) return MLibPtr();
+  const auto it = snapshot->find(filename);
+  if (it == snapshot->end()) return MLibPtr();
+  MLibPtr lib = it->second.lib.lock();
+  // a file changed since it was opened is opened again
+  if (lib != nullptr && stamp_file(filename) != it->second.stamp) return MLibPtr();
+  return lib;
+}
+
+// publish the result of an open and drop the libraries already closed
+// (call with the mutex locked)
+void publish_opened_lib(OpenedLibs *libs, const std::string &filename, const MLibPtr &lib,
+                        const FileStamp &stamp) {
+  std::shared_ptr<OpenedLibMap> next(new OpenedLibMap());
+  if (libs->snapshot != nullptr) {
+    for (const auto &opened : *libs->snapshot) {
+      if (opened.second.lib.expired() == false) next->insert(opened);
+    }
+  }
+  if (lib != nullptr) {
+    (*next)[filename] = OpenedLib{lib, stamp};
+  }
+  std::atomic_store(&libs->snapshot, std::shared_ptr<const OpenedLibMap>(std::move(next)));
+}
+
+} // namespace
 
 MLibPtr MLib::Open(const std::string &filename, const std::string &product) {
+  OpenedLibs &libs = opened_libs();
   // check if the library with the given filename has already been open
-  auto opened = opened_libs_.find(filename);
-  if (opened != opened_libs_.end()) {
-    if (opened->second.expired() == false) {
-      return opened->second.lock();
+  MLibPtr ret = find_opened_lib(libs, filename);
+  if (ret != nullptr) return ret;
+
+  // wait for another thread if it is opening the same file
+  std::promise<MLibPtr> promise;
+  std::shared_future<MLibPtr> pending;
+  {
+    std::lock_guard<std::mutex> lock(libs.mutex);
+    ret = find_opened_lib(libs, filename);
+    if (ret != nullptr) return ret;
+    const auto it = libs.pending.find(filename);
+    if (it != libs.pending.end()) {
+      pending = it->second;
+    } else {
+      libs.pending.emplace(filename, promise.get_future().share());
+    }
+  }
+  if (pending.valid()) {
+    return pending.get();
+  }
+
+  const FileStamp stamp = stamp_file(filename);
+  try {
+    ret = DoOpen(filename, product);
+  } catch (...) {
+    {
+      std::lock_guard<std::mutex> lock(libs.mutex);
+      libs.pending.erase(filename);
     }
-    opened_libs_.erase(opened);
+    promise.set_exception(std::current_exception());
+    throw;
+  }
+  {
+    std::lock_guard<std::mutex> lock(libs.mutex);
+    publish_opened_lib(&libs, filename, ret, stamp);
+    libs.pending.erase(filename);
   }
+  promise.set_value(ret);
+  return ret;
+}
 
+MLibPtr MLib::DoOpen(const std::string &filename, const std::string &product) {
   Reader *reader = mlib::CreateReader(filename, product);
   if (reader == nullptr) return nullptr;
-  char signature[4];
-  reader->Read(0, 4, signature);
 
+  // an up-to-date index saves reading the headers
   MLibPtr ret;
+  char signature[4] = {0};
+  MLIDX_t *indexed = MLIDX_t::Load(filename, product, reader);
+  if (indexed != nullptr) {
+    ret = MLibPtr(indexed);
+  } else {
+    reader->Read(0, 4, signature);
+  }
   if (signature[0] == 'L' && signature[1] == 'I' &&
       signature[2] == 'B') {
     if (signature[3] == 'P') {
@@ -175,9 +758,8 @@ MLibPtr MLib::Open(const std::string &filename, const std::string &product) {
       ret = MLibPtr(new LIB_t(filename, reader));
     }
   }
-  if (ret.use_count()) {
+  if (ret != nullptr) {
     ret->self_ = ret;
-    opened_libs_[filename] = ret;
   } else {
     delete reader;
   }
@@ -191,15 +773,18 @@ std::string MLib::GetLocation() const noexcept {
 }
 
 const MLibPtr MLib::GetOrCreateChild(size_t i) noexcept {
+  std::lock_guard<std::mutex> lock(children_mutex_);
   assert(i < children_.size());
   auto& p_child(children_.at(i));
-  if (p_child.expired()) {
+  // lock() rather than expired(): another thread may release the child
+  // between the check and the lock
+  const MLibPtr p_child_locked = p_child.lock();
+  if (p_child_locked == nullptr) {
     MLibPtr p_new_child(CreateChild(i));
     p_child = p_new_child;
     p_new_child->self_ = p_child;
     return p_new_child;
   }
-  const MLibPtr p_child_locked = p_child.lock();
   if (IsVerbose()) {
     std::cout << "[Info] MLib: '" << p_child_locked->GetName()
               << "' is already opened." << std::endl;
@@ -219,16 +804,19 @@ MLibPtr MLib::Child(size_t i) noexcept {
 }
 
 MLibPtr MLib::Child(const std::string &name) noexcept {
+  return Child(name.data(), name.size());
+}
+
+MLibPtr MLib::Child(const char *name, size_t length) noexcept {
   if (IsFile()) {
     return MLibPtr();
   }
   LoadChildInfo();
-  const auto it = child_name2index_.find(name);
-  if (it != child_name2index_.cend()) {
-    return GetOrCreateChild(it->second);
-  } else {
+  const size_t i = child_index_.Find(name, length);
+  if (i == FlatIndex::npos) {
     return MLibPtr();
   }
+  return GetOrCreateChild(i);
 }
 
 std::string MLib::GetChildName(size_t i) const noexcept {
@@ -236,6 +824,7 @@ std::string MLib::GetChildName(size_t i) const noexcept {
 }
 
 std::vector<std::string> MLib::GetChildNameList() const noexcept {
+  const_cast<MLib*>(this)->LoadChildInfo();
   std::vector<std::string> ret;
   const auto count = GetChildNumber();
   ret.reserve(count);
@@ -247,72 +836,66 @@ std::vector<std::string> MLib::GetChildNameList() const noexcept {
 
 void MLib::LoadChildInfo() {
   if (IsFile()) return;
-  const auto child_num = GetChildNumber();
-  if (children_.size() < child_num) {
-   children_.assign(child_num, std::weak_ptr<MLib>());
-  }
-  DoLoadChildInfo();
-  if (child_name2index_.size() == child_num) return;
-  for (unsigned int i = 0; i < child_num; ++i) {
-    child_name2index_[GetChildName(i)] = i;
-  }
+  // the child info never changes once loaded, so the lookups after this
+  // read it without a lock
+  std::call_once(child_info_loaded_, [this]() {
+    const auto child_num = GetChildNumber();
+    children_.assign(child_num, std::weak_ptr<MLib>());
+    DoLoadChildInfo();
+    child_index_.clear();
+    child_index_.Reserve(child_num);
+    for (unsigned int i = 0; i < child_num; ++i) {
+      const char *name = GetChildNameAsCharArray(i);
+      child_index_.Add(name, ::strlen(name));
+    }
+  });
 }
 
 MLibPtr MLib::GetEntry(const std::string &path, size_t index) noexcept {
-  const size_t delim_pos = path.find_first_of(kPathDelim, index);
-  const std::string target_entry_name =
-      (index == std::string::npos) ? "" :
-      (path.substr(index, (delim_pos == std::string::npos) ? std::string::npos : delim_pos - index));
-  const size_t sub_index =
-      (delim_pos == std::string::npos) ? std::string::npos : delim_pos + 1;
-  if (IsVerbose()) {
+  if (IsVerbose() && index != std::string::npos) {
     std::cout << "[Info] MLib: try to open '" << path.substr(index) << "'." << std::endl;
   }
-
-  if (target_entry_name == "") {
-    assert(self_.expired() == false);
-    return self_.lock();
-  }
-  if (IsFile()) {
-    if (target_entry_name == ".") {
-      const MLibPtr &parent = Parent();
-      if (parent.use_count() == 0) return nullptr;
-      return parent->GetEntry(path, sub_index);
+  assert(self_.expired() == false);
+  MLibPtr entry = self_.lock();
+  // walk the path name by name without copying them
+  while (index != std::string::npos) {
+    const size_t delim_pos = path.find(kPathDelim, index);
+    const char *name = path.data() + index;
+    const size_t length = ((delim_pos == std::string::npos) ? path.size() : delim_pos) - index;
+    index = (delim_pos == std::string::npos) ? std::string::npos : delim_pos + 1;
+    if (length == 0) break;
+    const bool is_dot = (length == 1 && name[0] == '.');
+    const bool is_dotdot = (length == 2 && name[0] == '.' && name[1] == '.');
+    if (is_dot || is_dotdot) {
+      // "." and ".." of a file are relative to the directory which has it
+      if (entry->IsFile()) {
+        entry = entry->Parent();
+        if (entry == nullptr) return entry;
+      }
+      if (is_dotdot) {
+        entry = entry->Parent();
+        if (entry == nullptr) return entry;
+      }
+      continue;
     }
-    if (target_entry_name == "..") {
-      MLibPtr parent = Parent();
-      if (parent.use_count() == 0) return parent;
-      parent = parent->Parent();
-      if (parent.use_count() == 0) return parent;
-      return parent->GetEntry(path, sub_index);
+    if (entry->IsFile()) {
+      return MLibPtr();
     }
-    return MLibPtr();
-  }
-  // pass through if IsDirectory().
-  if (target_entry_name == ".") {
-    return GetEntry(path, sub_index);
-  }
-  if (target_entry_name == "..") {
-    return Parent()->GetEntry(path, sub_index);
+    entry = entry->Child(name, length);
+    if (entry == nullptr) return entry;
   }
-
-  MLibPtr child = Child(target_entry_name);
-  if (child == nullptr) {
-    return child;
-  }
-  if (sub_index == std::string::npos) {
-    return child;
-  }
-  return child->GetEntry(path, sub_index);
+  return entry;
 }
 
 MLibPtr MLib::GetEntry(const std::string &path) noexcept {
-  std::string path_tmp(path);
-  std::replace(path_tmp.begin(), path_tmp.end(), kPathDelimNotUsed, kPathDelim);
-  if (path_tmp.back() == kPathDelim) {
-    path_tmp.pop_back();
+  MLibPtr ret;
+  if (path.find(kPathDelimNotUsed) == std::string::npos) {
+    ret = GetEntry(path, 0);
+  } else {
+    std::string path_tmp(path);
+    std::replace(path_tmp.begin(), path_tmp.end(), kPathDelimNotUsed, kPathDelim);
+    ret = GetEntry(path_tmp, 0);
   }
-  MLibPtr ret = GetEntry(path_tmp, 0);
   if (IsVerbose()) {
     if (ret == nullptr) {
       std::cout << "[Info] failed to open '" << path << "'." << std::endl;
@@ -344,6 +927,7 @@ bool MLib::HasOnlyDirectories() const noexcept {
 }
 
 size_t MLib::Read(off_t offset, size_t size, void *dest) {
+  Stats::GetInstance().Add(Stats::kMLibReads);
   const auto file_size = GetSize();
   if (static_cast<decltype(offset)>(file_size) <= offset) {
     return 0;
@@ -361,6 +945,13 @@ size_t MLib::Read(off_t offset, size_t size, void *dest) {
   return read_bytes;
 }
 
+const char *MLib::GetView(off_t offset, size_t size) const noexcept {
+  if (offset < 0 || GetSize() < offset + size) {
+    return nullptr;
+  }
+  return reader_->GetView(GetFileBaseOffset() + offset, size);
+}
+
 size_t MLib::Read(size_t size, void *dest) {
   // if (IsDirectory()) {
   //   return 0;
@@ -370,6 +961,27 @@ size_t MLib::Read(size_t size, void *dest) {
   return ret;
 }
 
+EntryRef MLib::GetEntryRef() noexcept {
+  if ( !IsOpen() ) return EntryRef();
+  // the entries from this up to the root
+  std::vector<const MLib*> chain;
+  MLib *root = this;
+  while (root->parent_ != nullptr) {
+    chain.push_back(root);
+    root = root->parent_.get();
+  }
+  std::call_once(root->entry_table_built_, [root]() {
+    root->entry_table_.reset(new EntryTable(root->reader_));
+    root->FillEntryTable(root->entry_table_.get());
+  });
+  if (root->entry_table_->size() == 0) return EntryRef();
+  EntryRef ref(root->entry_table_.get(), 0);
+  for (auto it = chain.crbegin(); ref && it != chain.crend(); ++it) {
+    ref = ref.Child((*it)->name());
+  }
+  return ref;
+}
+
 off_t MLib::Tell() const noexcept {
   if ( !IsFile() ) return -1;
   return file_pos_;
@@ -390,7 +1002,14 @@ off_t MLib::Seek(off_t new_pos, int whence) noexcept {
     return -1;
   }
   new_pos = std::max(static_cast<off_t>(0), new_pos);
-  file_pos_ = std::min(new_pos, static_cast<off_t>(GetSize()));
+  new_pos = std::min(new_pos, static_cast<off_t>(GetSize()));
+  if (new_pos != file_pos_) {
+    Stats &stats = Stats::GetInstance();
+    if (stats.IsEnabled()) {
+      stats.AddSeek(GetFullPath());
+    }
+  }
+  file_pos_ = new_pos;
   return file_pos_;
 }
 
@@ -428,10 +1047,10 @@ LIB_t::LIB_t(const std::string &lib_name, Reader *reader)
 }
 
 LIB_t::LIB_t(LIB_t* parent, const LIBENTRY &entry_info)
-  : MLib(parent), name_(entry_info.file_name),
+  : MLib(parent), hdr_(), name_(entry_info.file_name),
     offset_(parent->offset_ + entry_info.offset),
     file_size_(entry_info.length) {
-  Read(sizeof(hdr_), &hdr_);
+  Read(0, sizeof(hdr_), &hdr_);
   if (IsVerbose()) {
     std::cout << "[Info] opened '" << GetName() << "'." << std::endl;
   }
@@ -458,8 +1077,7 @@ void LIB_t::DoLoadChildInfo() noexcept {
   const auto num = hdr_.entry_count;
   if (entries_.size() == num) return;
   entries_.assign(num, LIBENTRY());
-  Seek(sizeof(LIBHDR), SEEK_SET);
-  Read(sizeof(LIBENTRY) * num, &entries_[0]);
+  Read(sizeof(LIBHDR), sizeof(LIBENTRY) * num, &entries_[0]);
 }
 
 const char *LIB_t::GetChildNameAsCharArray(size_t i) const noexcept {
@@ -476,6 +1094,14 @@ off_t LIB_t::GetFileBaseOffset() const noexcept {
   return offset_;
 }
 
+void LIB_t::FillEntryTable(EntryTable *table) noexcept {
+  fill_lib_entry_table<LIBHDR, LIBENTRY>(
+      reader().get(), std::string("LIB\0", 4).c_str(), table,
+      [](const LIBENTRY &entry) {
+        return std::string(entry.file_name, ::strnlen(entry.file_name, sizeof(entry.file_name)));
+      });
+}
+
 ////////////////////////////////////////////////////////////////////////
 // LIBU_t Class Function Definitions
 ////////////////////////////////////////////////////////////////////////
@@ -489,13 +1115,11 @@ LIBU_t::LIBU_t(const std::string &lib_name, Reader *reader)
 }
 
 LIBU_t::LIBU_t(LIBU_t *parent, const LIBUENTRY &entry_info)
-  : MLib(parent), name_(),
+  : MLib(parent), hdr_(), name_(),
     offset_(parent->offset_ + entry_info.offset),
     file_size_(entry_info.length) {
-  char mb_name[32*5 + 1];
-  UTF16ToUTF8(entry_info.file_name, mb_name);
-  name_.assign(mb_name);
-  Read(sizeof(hdr_), &hdr_);
+  name_ = DecodeName(entry_info);
+  Read(0, sizeof(hdr_), &hdr_);
   if (IsVerbose()) {
     std::cout << "[Info] opened '" << GetName() << "'." << std::endl;
   }
@@ -522,13 +1146,26 @@ void LIBU_t::DoLoadChildInfo() noexcept {
   const auto num = hdr_.entry_count;
   if (entries_.size() == num) return;
   entries_.assign(num, LIBUENTRY());
-  Seek(sizeof(LIBUHDR), SEEK_SET);
-  Read(sizeof(LIBUENTRY) * num, &entries_[0]);
+  Read(sizeof(LIBUHDR), sizeof(LIBUENTRY) * num, &entries_[0]);
+  child_names_.clear();
+  child_names_.reserve(num);
+  for (const auto &entry : entries_) {
+    child_names_.push_back(DecodeName(entry));
+  }
 }
 
 const char *LIBU_t::GetChildNameAsCharArray(size_t i) const noexcept {
-  assert(entries_.size() == hdr_.entry_count);
-  return entries_[i].file_name;
+  assert(child_names_.size() == hdr_.entry_count);
+  return child_names_[i].c_str();
+}
+
+std::string LIBU_t::DecodeName(const LIBUENTRY &entry) {
+  const size_t max_length = sizeof(entry.file_name) / sizeof(char16_t);
+  char16_t name[max_length];
+  ::memcpy(name, entry.file_name, sizeof(name));
+  size_t length = 0;
+  while (length < max_length && name[length] != 0) ++length;
+  return UTF16ToUTF8(name, length);
 }
 
 MLib *LIBU_t::CreateChild(size_t i) noexcept {
@@ -540,6 +1177,10 @@ off_t LIBU_t::GetFileBaseOffset() const noexcept {
   return offset_;
 }
 
+void LIBU_t::FillEntryTable(EntryTable *table) noexcept {
+  fill_lib_entry_table<LIBUHDR, LIBUENTRY>(reader().get(), "LIBU", table, &LIBU_t::DecodeName);
+}
+
 ////////////////////////////////////////////////////////////////////////
 // LIBP_t Class Function Definitions
 ////////////////////////////////////////////////////////////////////////
@@ -637,26 +1278,221 @@ off_t LIBP_t::GetFileBaseOffset() const noexcept {
   return base_offset;
 }
 
+void LIBP_t::FillEntryTable(EntryTable *table) noexcept {
+  // LIBP already has a flat table whose directories have contiguous children
+  const auto &entries = shobj_->entries_;
+  const auto &file_offsets = shobj_->file_offsets_;
+  const uint32_t count = static_cast<uint32_t>(entries.size());
+  for (uint32_t i = 0; i < count; ++i) {
+    const LIBPENTRY &entry = entries[i];
+    const bool is_file = (entry.flags & (LIBPENTRY::kFlagFile | LIBPENTRY::kFlagFile2));
+    int64_t base_offset = -1;
+    if (is_file && entry.offset_index < file_offsets.size()) {
+      base_offset = static_cast<int64_t>(file_offsets[entry.offset_index]) * 1024 +
+                    shobj_->data_base_offset_;
+    }
+    const std::string name(entry.file_name, ::strnlen(entry.file_name, sizeof(entry.file_name)));
+    table->AddNode(name, is_file, base_offset, is_file ? entry.length : 0);
+    if ( !is_file && static_cast<uint64_t>(entry.offset_index) + entry.length <= count ) {
+      table->SetChildren(i, entry.offset_index, entry.length);
+    }
+  }
+}
+
+////////////////////////////////////////////////////////////////////////
+// MLIDX_t Class Function Definitions
+////////////////////////////////////////////////////////////////////////
+
+MLIDX_t::SharedObject::~SharedObject() {
+  if (addr_ != nullptr) {
+    ::munmap(addr_, length_);
+  }
+}
+
+std::string MLIDX_t::GetIndexFilename(const std::string &lib_name) {
+  return lib_name + ".mlidx";
+}
+
+MLIDX_t *MLIDX_t::Load(const std::string &lib_name, const std::string &product, Reader *reader) {
+  static_assert(sizeof(IndexHeader) == 48, "size of IndexHeader must be 48");
+  static_assert(sizeof(IndexNode) == 32, "size of IndexNode must be 32");
+
+  struct stat st;
+  if (::stat(lib_name.c_str(), &st) != 0) return nullptr;
+  const int fd = ::open(GetIndexFilename(lib_name).c_str(), O_RDONLY);
+  Stats::GetInstance().Add(Stats::kSyscalls, 2);
+  if (fd < 0) return nullptr;
+  std::shared_ptr<SharedObject> shobj(new SharedObject());
+  struct stat index_st;
+  if (::fstat(fd, &index_st) == 0 && sizeof(IndexHeader) <= static_cast<size_t>(index_st.st_size)) {
+    void *addr = ::mmap(nullptr, index_st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (addr != MAP_FAILED) {
+      shobj->addr_ = addr;
+      shobj->length_ = index_st.st_size;
+    }
+  }
+  ::close(fd);
+  Stats::GetInstance().Add(Stats::kSyscalls, 3);
+  if (shobj->addr_ == nullptr) return nullptr;
+
+  // check if the index is of this archive and is consistent
+  const char *base = static_cast<const char*>(shobj->addr_);
+  const IndexHeader &hdr = *reinterpret_cast<const IndexHeader*>(base);
+  if (::memcmp(hdr.signature, "MLIX", 4) != 0 || hdr.version != kIndexVersion ||
+      hdr.archive_size != static_cast<uint64_t>(st.st_size) ||
+      hdr.mtime_sec != st.st_mtim.tv_sec || hdr.mtime_nsec != st.st_mtim.tv_nsec ||
+      hdr.key_hash != index_key_hash(product) ||
+      hdr.node_count == 0 || hdr.names_size == 0 ||
+      shobj->length_ < sizeof(IndexHeader) + sizeof(IndexNode) * static_cast<uint64_t>(hdr.node_count)
+                       + hdr.names_size) {
+    return nullptr;
+  }
+  shobj->hdr_ = &hdr;
+  shobj->nodes_ = reinterpret_cast<const IndexNode*>(base + sizeof(IndexHeader));
+  shobj->names_ = base + sizeof(IndexHeader) + sizeof(IndexNode) * hdr.node_count;
+  if (shobj->names_[hdr.names_size - 1] != '\0') return nullptr;
+  for (uint32_t i = 0; i < hdr.node_count; ++i) {
+    const IndexNode &node = shobj->nodes_[i];
+    if (hdr.names_size <= node.name_offset) return nullptr;
+    // children always follow their parent in breadth-first order
+    if (!(node.flags & IndexNode::kFlagFile) && node.child_count != 0 &&
+        (node.first_child <= i ||
+         hdr.node_count < static_cast<uint64_t>(node.first_child) + node.child_count)) {
+      return nullptr;
+    }
+  }
+  return new MLIDX_t(lib_name, reader, shobj);
+}
+
+bool MLIDX_t::Write(const std::string &lib_name, const std::string &product) {
+  struct stat st;
+  if (::stat(lib_name.c_str(), &st) != 0) return false;
+  const MLibPtr root = MLib::Open(lib_name, product);
+  if (root == nullptr) return false;
+  if (dynamic_cast<MLIDX_t*>(root.get()) != nullptr) return true;  // up to date
+
+  // resolve the whole tree in breadth-first order
+  std::vector<MLibPtr> entries(1, root);
+  std::vector<IndexNode> nodes;
+  std::string names;
+  for (size_t i = 0; i < entries.size(); ++i) {
+    const MLibPtr entry = entries[i];
+    IndexNode node = {};
+    node.base_offset = entry->GetBaseOffset();
+    node.size = entry->GetSize();
+    node.name_offset = static_cast<uint32_t>(names.size());
+    names.append(entry->GetName());
+    names.push_back('\0');
+    if (entry->IsFile()) {
+      node.flags = IndexNode::kFlagFile;
+    } else {
+      const std::vector<MLibPtr> children = entry->GetChildren();
+      node.first_child = static_cast<uint32_t>(entries.size());
+      node.child_count = static_cast<uint32_t>(children.size());
+      entries.insert(entries.end(), children.cbegin(), children.cend());
+    }
+    nodes.push_back(node);
+  }
+  IndexHeader hdr = {};
+  ::memcpy(hdr.signature, "MLIX", 4);
+  hdr.version = kIndexVersion;
+  hdr.node_count = static_cast<uint32_t>(nodes.size());
+  hdr.names_size = static_cast<uint32_t>(names.size());
+  hdr.archive_size = st.st_size;
+  hdr.mtime_sec = st.st_mtim.tv_sec;
+  hdr.mtime_nsec = st.st_mtim.tv_nsec;
+  hdr.key_hash = index_key_hash(product);
+
+  // write a temporary file and rename it, so that a reader never sees a partial index
+  const std::string index_filename = GetIndexFilename(lib_name);
+  std::ostringstream oss;
+  oss << index_filename << ".tmp." << ::getpid();
+  const std::string tmp_filename = oss.str();
+  std::ofstream ofs(tmp_filename, std::ios::out | std::ios::binary | std::ios::trunc);
+  ofs.write(reinterpret_cast<const char*>(&hdr), sizeof(hdr));
+  ofs.write(reinterpret_cast<const char*>(&nodes[0]), sizeof(IndexNode) * nodes.size());
+  ofs.write(names.data(), names.size());
+  ofs.close();
+  if (ofs && std::rename(tmp_filename.c_str(), index_filename.c_str()) == 0) {
+    return true;
+  }
+  std::cerr << "[Error] MLib: failed to write '" << index_filename << "'." << std::endl;
+  ::unlink(tmp_filename.c_str());
+  return false;
+}
+
+MLIDX_t::MLIDX_t(const std::string &lib_name, Reader *reader, const std::shared_ptr<SharedObject> &shobj)
+  : MLib(lib_name, reader), shobj_(shobj), node_index_(0),
+    name_(shobj_->names_ + shobj_->nodes_[0].name_offset) {
+  if (IsVerbose()) {
+    std::cout << "[Info] MLIDX: opened '" << libname() << "' with the index." << std::endl;
+  }
+}
+
+MLIDX_t::MLIDX_t(const std::shared_ptr<SharedObject> &shobj, MLIDX_t *parent, unsigned int node_index)
+  : MLib(parent), shobj_(shobj), node_index_(node_index),
+    name_(shobj_->names_ + shobj_->nodes_[node_index].name_offset) {
+  if (IsVerbose()) {
+    std::cout << "[Info] MLIDX: opened '" << GetName() << "'." << std::endl;
+  }
+}
+
+MLIDX_t::~MLIDX_t() {
+  if (IsVerbose()) {
+    std::cout << "[Info] MLIDX: closed '" << GetName() << "'." << std::endl;
+  }
+}
+
+bool MLIDX_t::IsFile() const noexcept {
+  return IsOpen() && (shobj_->nodes_[node_index_].flags & IndexNode::kFlagFile);
+}
+
+size_t MLIDX_t::GetSize() const noexcept {
+  return static_cast<size_t>(shobj_->nodes_[node_index_].size);
+}
+
+unsigned int MLIDX_t::GetChildNumber() const noexcept {
+  if ( !IsOpen() || IsFile() ) { return 0; }
+  return shobj_->nodes_[node_index_].child_count;
+}
+
+const char *MLIDX_t::GetChildNameAsCharArray(size_t i) const noexcept {
+  const IndexNode &child = shobj_->nodes_[shobj_->nodes_[node_index_].first_child + i];
+  return shobj_->names_ + child.name_offset;
+}
+
+MLib *MLIDX_t::CreateChild(size_t i) noexcept {
+  return new MLIDX_t(shobj_, this, shobj_->nodes_[node_index_].first_child + i);
+}
+
+off_t MLIDX_t::GetFileBaseOffset() const noexcept {
+  return static_cast<off_t>(shobj_->nodes_[node_index_].base_offset);
+}
+
+void MLIDX_t::FillEntryTable(EntryTable *table) noexcept {
+  // the index is already an entry table
+  table->Attach(shobj_->nodes_, shobj_->hdr_->node_count, shobj_->names_, shobj_);
+}
+
 ////////////////////////////////////////////////////////////////////////
 // File Class Definitions
 ////////////////////////////////////////////////////////////////////////
 
 OSFile::OSFile(const std::string &name)
-  : fp_(nullptr), name_() {
-#ifndef _WINDOWS
+  : fp_(nullptr), name_(), size_(0) {
   struct stat st;
   if (::stat(name.c_str(), &st) == -1) return;
   if (S_ISDIR(st.st_mode)) return;
-#endif
   fp_ = ::fopen(name.c_str(), "rb");
   if (fp_ != nullptr) {
+    size_ = static_cast<size_t>(st.st_size);
     name_.assign(relpath2abspath(name));
     // std::cout << "[Info] OSFile: opened '" << name_ << "'." << std::endl;
   }
 }
 
 OSFile::OSFile(OSFile &&f) noexcept
-  : fp_(f.fp_), name_(std::move(f.name_)) {
+  : fp_(f.fp_), name_(std::move(f.name_)), size_(f.size_) {
   f.fp_ = nullptr;
 }
 
@@ -675,23 +1511,11 @@ bool OSFile::IsFile() const noexcept {
 }
 
 std::string OSFile::GetName() const noexcept {
-  static std::regex re_name("[\\\\/]([^\\\\/]+)$");
-  std::smatch match;
-  if (std::regex_search(name_, match, re_name)) {
-    return match[1].str();
-  } else {
-    return std::string();
-  }
+  return path_name(name_);
 }
 
 std::string OSFile::GetLocation() const noexcept {
-  static std::regex re_location("^(.*[\\\\/])(?:[^\\\\/]+)$");
-  std::smatch match;
-  if (std::regex_match(name_, match, re_location)) {
-    return match[1].str();
-  } else {
-    return std::string();
-  }
+  return path_location(name_);
 }
 
 std::string OSFile::GetFullPath() const noexcept {
@@ -699,11 +1523,7 @@ std::string OSFile::GetFullPath() const noexcept {
 }
 
 size_t OSFile::GetSize() const noexcept {
-  auto t = ::ftell(fp_);
-  ::fseek(fp_, 0, SEEK_END);
-  auto ret = ::ftell(fp_);
-  ::fseek(fp_, t, SEEK_SET);
-  return ret;
+  return size_;
 }
 
 off_t OSFile::Seek(off_t offset, int whence) noexcept {
@@ -726,16 +1546,13 @@ size_t OSFile::Read(size_t size, void *dest) noexcept(false) {
 OSDirectory::OSDirectory(const std::string &path) {
   dirp_ = ::opendir(path.c_str());
   if (dirp_) {
-    name_ = relpath2abspath(path);
-    if (*name_.crbegin() == kPathDelim) {
-      name_.pop_back();
-    }
+    name_ = GenerateFullPath(path);
     // std::cout << "[Info] OSDirectory: opened '" << name_ << "'." << std::endl;
   }
 }
 
 OSDirectory::OSDirectory(OSDirectory &&d) noexcept
-  : dirp_(d.dirp_), name_(std::move(d.name_)) {
+  : dirp_(d.dirp_), name_(std::move(d.name_)), snapshot_(std::move(d.snapshot_)) {
   d.dirp_ = nullptr;
 }
 
@@ -754,23 +1571,11 @@ bool OSDirectory::IsDirectory() const noexcept {
 }
 
 std::string OSDirectory::GetName() const noexcept {
-  static std::regex re_name("[\\\\/]([^\\\\/]+)$");
-  std::smatch match;
-  if (std::regex_search(name_, match, re_name)) {
-    return match[1].str();
-  } else {
-    return std::string();
-  }
+  return path_name(name_);
 }
 
 std::string OSDirectory::GetLocation() const noexcept {
-  static std::regex re_location("^(.*[\\\\/])(?:[^\\\\/]*)$");
-  std::smatch match;
-  if (std::regex_match(name_, match, re_location)) {
-    return match[1].str();
-  } else {
-    return std::string();
-  }
+  return path_location(name_);
 }
 
 std::string OSDirectory::GetFullPath() const noexcept {
@@ -794,88 +1599,94 @@ OSFile* OSDirectory::OpenFile(const std::string &filename) const noexcept {
   return file;
 }
 
-OSDirectory* OSDirectory::OpenDirectory(const std::string& dirname) const noexcept {
-  if (dirp_ == nullptr) return nullptr;
-  seekdir(dirp_, 0);
-  OSDirectory* p_dir = nullptr;
+struct OSDirectory::Snapshot {
+  struct timespec mtime;
+  std::vector< std::pair<std::string, bool> > children;  // names and whether directories
+  std::unordered_map<std::string, size_t> index;        // names to indices of children
+};
+
+std::shared_ptr<const OSDirectory::Snapshot> OSDirectory::GetSnapshot() const noexcept {
+  std::lock_guard<std::mutex> lock(snapshot_mutex_);
+  struct stat st;
+  if (::fstat(::dirfd(dirp_), &st) != 0) return snapshot_;
+  if (snapshot_ != nullptr &&
+      snapshot_->mtime.tv_sec == st.st_mtim.tv_sec &&
+      snapshot_->mtime.tv_nsec == st.st_mtim.tv_nsec) {
+    return snapshot_;
+  }
+  std::shared_ptr<Snapshot> snapshot(new Snapshot());
+  snapshot->mtime = st.st_mtim;
+  ::rewinddir(dirp_);
   struct dirent* dp;
-  while ((dp = readdir(dirp_)) != nullptr) {
-    if (dirname != dp->d_name) continue;
+  while ((dp = ::readdir(dirp_)) != nullptr) {
+    if ( dp->d_name[0] == '.' &&
+         (dp->d_name[1] == '\0' || (dp->d_name[1] == '.' && dp->d_name[2] == '\0')) ) {
+      continue;
+    }
+    bool is_directory;
 #ifndef _WINDOWS
-    if (dp->d_type != DT_DIR) continue;
+    if (dp->d_type == DT_DIR || dp->d_type == DT_REG) {
+      is_directory = (dp->d_type == DT_DIR);
+    } else
 #endif
-    p_dir = new OSDirectory(GetFullPath() + kPathDelim + dp->d_name);
-    if ( !p_dir->IsOpen() ) {
-      delete p_dir;
-      return nullptr;
-    } else {
-      return p_dir;
+    {
+      // a symbolic link, or a file system which does not tell the type
+      struct stat child_st;
+      const std::string child_path = name_ + kPathDelim + dp->d_name;
+      if (::stat(child_path.c_str(), &child_st) != 0) continue;
+      is_directory = S_ISDIR(child_st.st_mode);
     }
+    snapshot->index.insert(std::make_pair(dp->d_name, snapshot->children.size()));
+    snapshot->children.push_back(std::make_pair(dp->d_name, is_directory));
   }
-  return nullptr;
+  snapshot_ = snapshot;
+  return snapshot_;
 }
 
-OSEntry* OSDirectory::OpenChild(const std::string& child_name) const noexcept {
-  if (dirp_ == nullptr) return nullptr;
-  seekdir(dirp_, 0);
+OSEntry* OSDirectory::OpenChild(const std::string& child_name, bool is_directory) const noexcept {
+  const std::string child_path = name_ + kPathDelim + child_name;
   OSEntry* p_entry;
-  struct dirent* dp;
-  while ((dp = readdir(dirp_)) != nullptr) {
-    if (child_name != dp->d_name) continue;
-#ifdef _WINDOWS
-    p_entry = new OSFile(child_name);
-    if (p_entry->IsOpen() == false) {
-      delete p_entry;
-      p_entry = new OSDirectory(child_name);
-    }
-#else
-    if (dp->d_type == DT_DIR) {
-      p_entry = new OSDirectory(child_name);
-    } else {
-      p_entry = new OSFile(child_name);
-    }
-#endif
-    if ( !p_entry->IsOpen() ) {
-      delete p_entry;
-      return nullptr;
-    } else {
-      return p_entry;
-    }
+  if (is_directory) {
+    p_entry = new OSDirectory(child_path);
+  } else {
+    p_entry = new OSFile(child_path);
+  }
+  if ( !p_entry->IsOpen() ) {
+    delete p_entry;
+    return nullptr;
   }
-  return nullptr;
+  return p_entry;
+}
+
+OSDirectory* OSDirectory::OpenDirectory(const std::string& dirname) const noexcept {
+  if (dirp_ == nullptr) return nullptr;
+  const auto snapshot = GetSnapshot();
+  if (snapshot == nullptr) return nullptr;
+  const auto it = snapshot->index.find(dirname);
+  if (it == snapshot->index.end() || !snapshot->children[it->second].second) {
+    return nullptr;
+  }
+  return static_cast<OSDirectory*>(OpenChild(dirname, true));
+}
+
+OSEntry* OSDirectory::OpenChild(const std::string& child_name) const noexcept {
+  if (dirp_ == nullptr) return nullptr;
+  const auto snapshot = GetSnapshot();
+  if (snapshot == nullptr) return nullptr;
+  const auto it = snapshot->index.find(child_name);
+  if (it == snapshot->index.end()) return nullptr;
+  return OpenChild(child_name, snapshot->children[it->second].second);
 }
 
 std::vector<OSEntry*> OSDirectory::GetChildren() const noexcept {
   if (dirp_ == nullptr) return std::vector<OSEntry*>();
+  const auto snapshot = GetSnapshot();
+  if (snapshot == nullptr) return std::vector<OSEntry*>();
   std::vector<OSEntry*> ret;
-  seekdir(dirp_, 0);
-  OSEntry* p;
-  struct dirent* dp;
-  while ((dp = readdir(dirp_)) != nullptr) {
-    if ( dp->d_name[0] == '.' &&
-         (dp->d_name[1] == '\0' || dp->d_name[1] == '.') ) {
-      continue;
-    }
-    std::string child_name(name_);
-    child_name.append(1, kPathDelim).append(dp->d_name);
-#ifdef _WINDOWS
-    p = new OSFile(child_name);
-    if (p->IsOpen() == false) {
-      delete p;
-      p = new OSDirectory(child_name);
-    }
-#else
-    if (dp->d_type == DT_DIR) {
-      p = new OSDirectory(child_name);
-    } else {
-      p = new OSFile(child_name);
-    }
-#endif
-    if ( !p->IsOpen() ) {
-      delete p;
-      continue;
-    }
-    ret.push_back(p);
+  ret.reserve(snapshot->children.size());
+  for (const auto &child : snapshot->children) {
+    OSEntry* p = OpenChild(child.first, child.second);
+    if (p) ret.push_back(p);
   }
   return ret;
 }
@@ -885,12 +1696,12 @@ std::vector<OSEntry*> OSDirectory::GetChildren() const noexcept {
 ////////////////////////////////////////////////////////////////////////
 
 VersionedEntry::VersionedEntry()
-  : p_os_entry_(nullptr), p_curr_(nullptr), curr_ver_(0) {}
+  : p_os_entry_(nullptr), p_curr_(nullptr), curr_ver_(0), pos_(0), overlay_node_(OverlayIndex::npos) {}
 
 VersionedEntry::VersionedEntry(OSEntry* p_os_entry,
                                std::vector<MLibPtr>&& mlib_history) noexcept
   : p_os_entry_(p_os_entry), mlib_entries_(std::move(mlib_history)),
-    p_curr_(nullptr), curr_ver_(0) {
+    p_curr_(nullptr), curr_ver_(0), pos_(0), overlay_node_(OverlayIndex::npos) {
   if (p_os_entry && p_os_entry->IsOpen()) {
     name_ = p_os_entry->GetFullPath();
   } else if ( !mlib_entries_.empty() ) {
@@ -901,7 +1712,7 @@ VersionedEntry::VersionedEntry(OSEntry* p_os_entry,
 
 VersionedEntry::VersionedEntry(const std::string& path,
                                const std::string& product) 
-  : p_curr_(nullptr), curr_ver_(0) {
+  : p_curr_(nullptr), curr_ver_(0), pos_(0), overlay_node_(OverlayIndex::npos) {
   // 1. Open an OS entry.
   OSEntry* p_os_entry = new OSFile(path);
   if ( !p_os_entry->IsOpen() ) {
@@ -927,8 +1738,16 @@ VersionedEntry::VersionedEntry(const std::string& path,
   std::string path_left = path;
   std::string path_right = "";
   while ( !path_left.empty() ) {
-    mlib_entries_ = GetMLibEntryHistory(path_left, product, path_right);
+    std::shared_ptr<const OverlayIndex> overlay;
+    mlib_entries_ = GetMLibEntryHistory(path_left, product, path_right, &overlay);
     if ( !mlib_entries_.empty() ) {
+      // the node has the same versions unless the path has "." or ".."
+      const uint32_t node = overlay ? overlay->Find(path_right) : OverlayIndex::npos;
+      if (node != OverlayIndex::npos &&
+          overlay->node(node).version_count == mlib_entries_.size()) {
+        overlay_ = std::move(overlay);
+        overlay_node_ = node;
+      }
       break;
     }
     // [left, right] : ["foo/bar", "baz"] => ["foo", "bar/baz"]
@@ -958,7 +1777,8 @@ VersionedEntry::VersionedEntry(VersionedEntry&& e) noexcept
   : p_os_entry_(e.p_os_entry_),
     mlib_entries_(std::move(e.mlib_entries_)),
     name_(std::move(e.name_)),
-    p_curr_(e.p_curr_), curr_ver_(e.curr_ver_) {
+    p_curr_(e.p_curr_), curr_ver_(e.curr_ver_), pos_(e.pos_),
+    overlay_(std::move(e.overlay_)), overlay_node_(e.overlay_node_) {
   e.p_os_entry_ = nullptr;
 }
 
@@ -978,6 +1798,7 @@ int VersionedEntry::GetCurrentVersion() const noexcept {
 
 void VersionedEntry::SwitchVersion(int new_version) noexcept {
   if (GetLatestVersion() == 0) return;
+  Entry* const p_prev = p_curr_;
   if (new_version > 0) {
     int i = static_cast<int>(mlib_entries_.size()) - new_version;
     if (i >= 0) {
@@ -1008,6 +1829,9 @@ void VersionedEntry::SwitchVersion(int new_version) noexcept {
       curr_ver_ = GetLatestVersion();
     }
   }
+  if (p_curr_ != p_prev) {
+    pos_ = 0;
+  }
 }
 
 bool VersionedEntry::IsOpen() const noexcept {
@@ -1027,25 +1851,11 @@ bool VersionedEntry::IsRaw() const noexcept {
 }
 
 std::string VersionedEntry::GetName() const noexcept {
-  static std::regex re_name("^.*[\\\\/]([^\\\\/]*)$");
-  std::smatch match;
-  if (std::regex_match(name_, match, re_name)) {
-    // std::cout << name_ <<  " -> " << match.str() << std::endl;
-    return match[1].str();
-  } else {
-    // std::cout << name_ << std::endl;
-    return std::string();
-  }
+  return path_name(name_);
 }
 
 std::string VersionedEntry::GetLocation() const noexcept {
-  static std::regex re_location("^(.*[\\\\/])(?:[^\\\\/]*)$");
-  std::smatch match;
-  if (std::regex_match(name_, match, re_location)) {
-    return match[1].str();
-  } else {
-    return std::string();
-  }
+  return path_location(name_);
 }
 
 std::string VersionedEntry::GetFullPath() const noexcept {
@@ -1059,17 +1869,131 @@ size_t VersionedEntry::GetSize() const noexcept {
 
 off_t VersionedEntry::Seek(off_t offset, int whence) noexcept {
   if (p_curr_ == nullptr) return -1;
-  return p_curr_->Seek(offset, whence);
+  if (p_curr_->IsRaw()) return p_curr_->Seek(offset, whence);
+  // an archive entry may be shared with other entries, so the position is kept here
+  switch (whence) {
+  case SEEK_SET:
+    break;
+  case SEEK_CUR:
+    offset += pos_;
+    break;
+  case SEEK_END:
+    offset += static_cast<off_t>(p_curr_->GetSize());
+    break;
+  default:
+    return -1;
+  }
+  offset = std::max(static_cast<off_t>(0), offset);
+  offset = std::min(offset, static_cast<off_t>(p_curr_->GetSize()));
+  if (offset != pos_) {
+    Stats &stats = Stats::GetInstance();
+    if (stats.IsEnabled()) {
+      stats.AddSeek(p_curr_->GetFullPath());
+    }
+  }
+  pos_ = offset;
+  return pos_;
 }
 
 size_t VersionedEntry::Read(size_t size, void* dest) noexcept(false) {
   if (p_curr_ == nullptr) return 0UL;
-  return p_curr_->Read(size, dest);
+  if (p_curr_->IsRaw()) return p_curr_->Read(size, dest);
+  const size_t ret = static_cast<MLib*>(p_curr_)->Read(pos_, size, dest);
+  pos_ += ret;
+  return ret;
+}
+
+const char* VersionedEntry::GetView() const noexcept {
+  if (p_curr_ == nullptr || p_curr_->IsRaw()) return nullptr;
+  return static_cast<MLib*>(p_curr_)->GetView();
+}
+
+MLib* VersionedEntry::GetCurrentMLib() const noexcept {
+  if (p_curr_ == nullptr || p_curr_->IsRaw()) return nullptr;
+  return static_cast<MLib*>(p_curr_);
+}
+
+ArchiveSetSnapshot VersionedEntry::GetSnapshot(int version) const noexcept {
+  if (overlay_ == nullptr) return ArchiveSetSnapshot();
+  return ArchiveSetSnapshot(overlay_, overlay_node_, version);
+}
+
+bool VersionedEntry::OpenOverlayChild(uint32_t parent, const std::vector<MLibPtr>& parent_history,
+                                      uint32_t node, std::vector<MLibPtr>* history) const noexcept {
+  const uint32_t version_count = overlay_->node(node).version_count;
+  const uint32_t parent_version_count = overlay_->node(parent).version_count;
+  if (parent_history.size() != parent_version_count) return false;
+  const std::string name(overlay_->name(node));
+  history->reserve(version_count);
+  uint32_t k = 0;
+  for (uint32_t j = 0; j < version_count; ++j) {
+    // both lists are the latest first, so the parent version is found in one pass
+    const uint32_t layer = overlay_->version(node, j).layer;
+    while (k < parent_version_count && overlay_->version(parent, k).layer != layer) ++k;
+    if (k == parent_version_count) return false;
+    auto p_mlib_child = parent_history[k]->Child(name);
+    if ( p_mlib_child == nullptr || !p_mlib_child->IsOpen() ) return false;
+    history->push_back(std::move(p_mlib_child));
+  }
+  return true;
+}
+
+void VersionedEntry::ResolveChild(const std::string& path, std::vector<MLibPtr>* history,
+                                  uint32_t* overlay_node) const noexcept {
+  *overlay_node = OverlayIndex::npos;
+  if (mlib_entries_.empty()) return;
+  PathCache& cache = PathCache::GetInstance();
+  const std::string key = PathCache::Key(mlib_entries_, overlay_, path);
+  if (cache.Find(key, history, overlay_node)) return;
+
+  if (is_plain_path(path)) {
+    // resolve the name in the versions of the parent, which neighbouring paths share
+    const size_t delim_pos = path.find_last_of(kPathDelims);
+    const std::string name = (delim_pos == std::string::npos) ? path : path.substr(delim_pos + 1);
+    std::vector<MLibPtr> parent_history;
+    uint32_t parent = overlay_ ? overlay_node_ : OverlayIndex::npos;
+    if (delim_pos != std::string::npos) {
+      ResolveChild(path.substr(0, delim_pos), &parent_history, &parent);
+    }
+    const std::vector<MLibPtr>& parents =
+        (delim_pos == std::string::npos) ? mlib_entries_ : parent_history;
+    bool resolved = false;
+    if (parent != OverlayIndex::npos) {
+      // a name which is not in the overlay index is in no version
+      const uint32_t node = overlay_->Child(parent, name.data(), name.size());
+      resolved = (node == OverlayIndex::npos) ||
+                 OpenOverlayChild(parent, parents, node, history);
+      if (resolved) *overlay_node = node;
+    }
+    if ( !resolved ) {
+      history->clear();
+      for (auto& p_mlib : parents) {
+        if ( !p_mlib->IsDirectory() ) continue;
+        auto p_mlib_child = p_mlib->Child(name);
+        if ( p_mlib_child == nullptr || !p_mlib_child->IsOpen() ) continue;
+        history->push_back(std::move(p_mlib_child));
+      }
+    }
+  } else {
+    history->reserve(mlib_entries_.size());
+    for (auto& p_mlib : mlib_entries_) {
+      assert(p_mlib != nullptr);
+      if ( !p_mlib->IsDirectory() ) continue;
+      auto p_mlib_child = p_mlib->GetEntry(path);
+      if ( p_mlib_child == nullptr || !p_mlib_child->IsOpen() ) continue;
+      history->push_back(std::move(p_mlib_child));
+    }
+  }
+  PathCache::Value value;
+  value.base = mlib_entries_;
+  value.overlay = overlay_;
+  value.history = *history;
+  value.overlay_node = *overlay_node;
+  cache.Insert(key, std::move(value));
 }
 
 VersionedEntry* VersionedEntry::OpenChild(const std::string& child_name) const noexcept {
   OSEntry* p_os_child = nullptr;
-  std::vector<MLibPtr> mlib_child_history;
   if (p_os_entry_ && p_os_entry_->IsDirectory()) {
     OSDirectory* p_osdir = dynamic_cast<OSDirectory*>(p_os_entry_);
     assert(p_osdir);
@@ -1079,18 +2003,68 @@ VersionedEntry* VersionedEntry::OpenChild(const std::string& child_name) const n
       p_os_child = nullptr;
     }
   }
-  mlib_child_history.reserve(mlib_entries_.size());
-  for (auto& p_mlib : mlib_entries_) {
-    assert(p_mlib != nullptr);
-    if ( !p_mlib->IsDirectory() ) continue;
-    auto p_mlib_child = p_mlib->GetEntry(child_name);
-    if ( p_mlib_child == nullptr || !p_mlib_child->IsOpen() ) continue;
-    mlib_child_history.push_back(std::move(p_mlib_child));
+  std::vector<MLibPtr> mlib_child_history;
+  uint32_t node;
+  ResolveChild(child_name, &mlib_child_history, &node);
+  VersionedEntry* p_entry = new VersionedEntry(p_os_child, std::move(mlib_child_history));
+  if (node != OverlayIndex::npos) {
+    p_entry->overlay_ = overlay_;
+    p_entry->overlay_node_ = node;
   }
-  return new VersionedEntry(p_os_child, std::move(mlib_child_history));
+  return p_entry;
 }
 
 std::vector<VersionedEntry*> VersionedEntry::GetChildren() const noexcept {
+  if (overlay_) {
+    // merge the OS children into the children of the overlay node, both sorted by name
+    std::vector< std::pair<std::string, OSEntry*> > os_children;
+    if (p_os_entry_ && p_os_entry_->IsDirectory()) {
+      OSDirectory* p_osdir = dynamic_cast<OSDirectory*>(p_os_entry_);
+      assert(p_osdir);
+      for (auto& p_child : p_osdir->GetChildren()) {
+        os_children.push_back(std::make_pair(p_child->GetName(), p_child));
+      }
+      std::sort(os_children.begin(), os_children.end());
+    }
+    const auto& node = overlay_->node(overlay_node_);
+    uint32_t c = node.first_child;
+    const uint32_t end = c + node.child_count;
+    size_t k = 0;
+    std::vector<VersionedEntry*> children;
+    children.reserve(os_children.size() + node.child_count);
+    while (k < os_children.size() || c < end) {
+      const int cmp = (k == os_children.size()) ? 1 :
+                      (c == end) ? -1 : ::strcmp(os_children[k].first.c_str(), overlay_->name(c));
+      VersionedEntry* p_entry = new VersionedEntry;
+      if (cmp <= 0) {
+        p_entry->p_os_entry_ = os_children[k].second;
+        p_entry->name_ = name_ + kPathDelim + os_children[k].first;
+        ++k;
+      }
+      if (cmp >= 0) {
+        if (OpenOverlayChild(overlay_node_, mlib_entries_, c, &p_entry->mlib_entries_)) {
+          p_entry->overlay_ = overlay_;
+          p_entry->overlay_node_ = c;
+        } else {
+          // the index does not match the archives, so look the name up in each of them
+          p_entry->mlib_entries_.clear();
+          for (auto& p_mlib : mlib_entries_) {
+            if ( !p_mlib->IsDirectory() ) continue;
+            auto p_mlib_child = p_mlib->Child(std::string(overlay_->name(c)));
+            if ( p_mlib_child == nullptr || !p_mlib_child->IsOpen() ) continue;
+            p_entry->mlib_entries_.push_back(std::move(p_mlib_child));
+          }
+        }
+        if (cmp > 0) {
+          p_entry->name_ = name_ + kPathDelim + overlay_->name(c);
+        }
+        ++c;
+      }
+      p_entry->SwitchVersion(curr_ver_);
+      children.push_back(p_entry);
+    }
+    return children;
+  }
   std::map<std::string, VersionedEntry*> children_map;
   if (p_os_entry_ && p_os_entry_->IsDirectory()) {
     OSDirectory* p_osdir = dynamic_cast<OSDirectory*>(p_os_entry_);
@@ -1143,8 +2117,11 @@ std::vector<VersionedEntry*> VersionedEntry::GetChildren() const noexcept {
 // Convert UTF16 to UTF8
 ////////////////////////////////////////////////////////////////////////
 
-static std::wstring_convert<std::codecvt_utf8_utf16<char16_t>, char16_t>
-  conv_to_bytes;
+// std::wstring_convert keeps a conversion state, so each thread has its own.
+static std::wstring_convert<std::codecvt_utf8_utf16<char16_t>, char16_t> &conv_to_bytes() {
+  thread_local std::wstring_convert<std::codecvt_utf8_utf16<char16_t>, char16_t> conv;
+  return conv;
+}
 
 size_t UTF16ToUTF8(const char *src, char *dst) {
   const char *dst_start = dst;
@@ -1185,11 +2162,11 @@ size_t UTF16ToUTF8(const char *src, char *dst) {
 }
 
 std::string UTF16ToUTF8(const char16_t *src, size_t length) {
-  return conv_to_bytes.to_bytes(src, src + length);
+  return conv_to_bytes().to_bytes(src, src + length);
 }
 
 std::string UTF16ToUTF8(const std::u16string &src) {
-  return conv_to_bytes.to_bytes(src);
+  return conv_to_bytes().to_bytes(src);
 }
 
 ////////////////////////////////////////////////////////////////////////
@@ -1200,17 +2177,59 @@ Reader *CreateReader(const std::string &filename, const std::string &product) {
   const KeyInfo *kinfo;
   if (FindKeyInfo(product, &kinfo) == false ||
       kinfo->cipher_type() == CipherType::kCipherNone) {
+    MappedReader *reader = new MappedReader(filename);
+    if (reader->IsOpen()) return reader;
+    delete reader;
     return new PlainReader(filename);
-  } else if (kinfo->cipher_type() == CipherType::kCipherCamellia128) {
-    return new CamelliaDecrypter(filename, kinfo->key_string());
+  }
+  Reader *decrypter = nullptr;
+  if (kinfo->cipher_type() == CipherType::kCipherCamellia128) {
+    decrypter = new CamelliaDecrypter(filename, kinfo->key_string());
   } else if (kinfo->cipher_type() == CipherType::kCipherEqualMoreThanSLT) {
-    return new SecondCryptoDecrypter(filename, kinfo->key_string());
+    decrypter = new SecondCryptoDecrypter(filename, kinfo->key_string());
   } else {
     std::ostringstream oss;
     oss << '\'' << kinfo->cipher_type() << "' is invalid cipher type."
         << " (product code: " << product << ')';
     throw std::invalid_argument(oss.str());
   }
+  // use the decrypted copy in the shadow cache if enabled
+  ShadowCache &shadow_cache = ShadowCache::GetInstance();
+  if (shadow_cache.IsEnabled()) {
+    Reader *reader = shadow_cache.Open(filename, kinfo->cipher_type(),
+                                       kinfo->key_string(), decrypter);
+    if (reader) {
+      delete decrypter;
+      return reader;
+    }
+  }
+  return decrypter;
+}
+
+Encrypter *CreateEncrypter(const std::string &product) {
+  const KeyInfo *kinfo;
+  if (FindKeyInfo(product, &kinfo) == false) return nullptr;
+  switch (kinfo->cipher_type()) {
+  case CipherType::kCipherCamellia128:
+    return new CamelliaEncrypter(kinfo->key_string());
+  case CipherType::kCipherEqualMoreThanSLT:
+    return new SecondCryptoEncrypter(kinfo->key_string());
+  default:
+    return nullptr;
+  }
+}
+
+void SetShadowCacheDirectory(const std::string &dir) {
+  ShadowCache::GetInstance().SetDirectory(dir);
+}
+
+void ClearArchiveSetCache() {
+  ArchiveSetCache::GetInstance().Clear();
+  PathCache::GetInstance().Clear();
+}
+
+void SetPathCacheCapacity(size_t count) {
+  PathCache::GetInstance().SetCapacity(count);
 }
 
 ////////////////////////////////////////////////////////////////////////
@@ -1218,30 +2237,10 @@ Reader *CreateReader(const std::string &filename, const std::string &product) {
 ////////////////////////////////////////////////////////////////////////
 
 std::string GenerateFullPath(const std::string &path) {
-  char cwd[PATH_MAX];
-  if (::getcwd(cwd, PATH_MAX) == nullptr) return std::string();
-  std::string fullpath(cwd);
-  std::string buf;
-  size_t pos = 0;
-  size_t next_pos = std::string::npos;
-  do {
-    next_pos = path.find_first_of(kPathDelim, pos);
-    buf = path.substr(pos, next_pos);
-    if (buf.empty()) break;
-    pos = next_pos;
-    if (pos != std::string::npos) {
-      ++pos;
-    }
-    if (buf == ".") continue;
-    if (buf == "..") {
-      const size_t fullpath_last_delim_pos = fullpath.find_last_of(kPathDelim);
-      if (fullpath_last_delim_pos == std::string::npos) return std::string();
-      fullpath.erase(fullpath_last_delim_pos);
-      continue;
-    }
-    fullpath.append(1, kPathDelim);
-    fullpath.append(buf);
-  } while (pos != std::string::npos);
+  std::string fullpath = relpath2abspath(path);
+  if (root_length(fullpath) < fullpath.size() && is_path_delim(fullpath.back())) {
+    fullpath.pop_back();
+  }
   return fullpath;
 }
 
@@ -1289,6 +2288,10 @@ bool LoadKeyInfo(const std::string &csv) {
   return true;
 }
 
+bool WriteIndex(const std::string &filename, const std::string &product) {
+  return MLIDX_t::Write(filename, product);
+}
+
 bool FindKeyInfo(const std::string &product, const KeyInfo **dest) {
   if (dest == nullptr) return false;
   const auto it_key = key_info_.find(product);
@@ -1358,4 +2361,70 @@ unsigned int GetDataAlignment(const std::string &product) {
   return keyinfo.data_alignment();
 }
 
+std::vector<ProductCandidate> DetectProduct(const std::string &filename) {
+  std::vector<ProductCandidate> candidates;
+  std::ifstream ifs(filename, std::ios::in | std::ios::binary);
+  if (!ifs) return candidates;
+  ifs.seekg(0, std::ios::end);
+  const size_t file_size = static_cast<size_t>(ifs.tellg());
+  ifs.seekg(0, std::ios::beg);
+  // the probe must be a multiple of the cipher block size
+  const size_t probe_size = std::min<size_t>(file_size, 65536) & ~static_cast<size_t>(15);
+  std::vector<char> raw(probe_size);
+  if (probe_size == 0 || !ifs.read(&raw[0], probe_size)) return candidates;
+  ifs.close();
+
+  std::vector<std::pair<std::string, const KeyInfo *> > keys;
+  for (const auto &kv : key_info_) {
+    keys.emplace_back(kv.first, &kv.second);
+  }
+  std::atomic<size_t> next(0);
+  std::mutex mutex;
+  auto probe = [&]() {
+    std::vector<char> buf(probe_size);
+    KEY_TABLE_TYPE camellia_key_table;
+    Crypto2KeyTable crypto2_key_table;
+    for (size_t i = next++; i < keys.size(); i = next++) {
+      const KeyInfo &kinfo = *keys[i].second;
+      // only the key schedule runs on the probe; a decrypter would open the file
+      std::copy(raw.cbegin(), raw.cend(), buf.begin());
+      switch (kinfo.cipher_type()) {
+      case CipherType::kCipherNone:
+        break;
+      case CipherType::kCipherCamellia128:
+        Camellia_Ekeygen(128, kinfo.key_string(), camellia_key_table);
+        CamelliaDecode(camellia_key_table, 0, &buf[0], probe_size);
+        break;
+      case CipherType::kCipherEqualMoreThanSLT:
+        Crypto2_Ekeygen(kinfo.key_string(), &crypto2_key_table);
+        Crypto2_DecryptBlocks(crypto2_key_table, 0,
+                              reinterpret_cast<unsigned char *>(&buf[0]), probe_size >> 4);
+        break;
+      default:
+        continue;
+      }
+      std::string format;
+      const unsigned int score = score_archive_header(
+          reinterpret_cast<const unsigned char *>(&buf[0]), probe_size, file_size, &format);
+      if (score == 0) continue;
+      std::lock_guard<std::mutex> lock(mutex);
+      candidates.push_back(ProductCandidate{keys[i].first, format, score});
+    }
+  };
+  const size_t thread_count =
+      std::max<size_t>(1, std::min<size_t>(std::thread::hardware_concurrency(), keys.size()));
+  std::vector<std::thread> threads;
+  for (size_t i = 1; i < thread_count; ++i) {
+    threads.emplace_back(probe);
+  }
+  probe();
+  for (auto &t : threads) t.join();
+
+  std::sort(candidates.begin(), candidates.end(),
+            [](const ProductCandidate &a, const ProductCandidate &b) {
+              return (a.score != b.score) ? (a.score > b.score) : (a.product < b.product);
+            });
+  return candidates;
+}
+
 } // namespace mlib
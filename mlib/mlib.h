@@ -25,6 +25,9 @@
 #include <map>
 #include <string>
 #include <memory>
+#include <mutex>
+#include "entry_ref.h"
+#include "flat_index.h"
 // #include <std/shared_ptr.hpp>
 // #include <std/weak_ptr.hpp>
 
@@ -77,6 +80,18 @@ private:
   unsigned int data_alignment_;
 };
 
+////////////////////////////////////////////////////////////////////////
+/// @brief ProductCandidate struct
+///
+/// A product whose key decodes the header of an archive (see DetectProduct()).
+////////////////////////////////////////////////////////////////////////
+
+struct ProductCandidate {
+  std::string product;
+  std::string format;  // "LIB", "LIBU" or "LIBP"
+  unsigned int score;  // 1 + the count of plausible header fields and entries
+};
+
 ////////////////////////////////////////////////////////////////////////
 /// @brief Entry interface class
 ////////////////////////////////////////////////////////////////////////
@@ -161,10 +176,18 @@ public:
 
 ////////////////////////////////////////////////////////////////////////
 /// @brief MLib class
+///
+/// Thread safety: Open() may be called from any thread, and concurrent
+/// opens of the same file share one tree. The lookups (Child(),
+/// GetEntry(), GetChildren(), GetEntryRef()) and the positional Read()
+/// may be called on one entry from several threads. The file position
+/// used by Seek(), Tell() and the sequential Read() belongs to the entry,
+/// so a thread which uses it should have the entry to itself.
 ////////////////////////////////////////////////////////////////////////
 
 class MLib;
 class Reader;
+class Encrypter;
 
 typedef std::shared_ptr<MLib> MLibPtr;
 
@@ -180,6 +203,8 @@ public:
    * @param[in] filename a MLib filename.
    * @param[in] product a product code name.
    * @return a shared pointer to a created MLib entry if success, and a null pointer otherwise.
+   * @note The index file of the archive is loaded instead of its headers if it is up to date.
+   * @see MLIDX_t, WriteIndex()
    */ 
   static MLibPtr Open(const std::string &filename, const std::string &product);
 
@@ -337,6 +362,48 @@ public:
    */
   size_t Read(off_t offset, size_t size, void *dest);
 
+  /**
+   * @brief Returns a read-only view of this file contents without copying.
+   * @param[in] offset an offset from the beginning of this file.
+   * @param[in] size the size of the view.
+   * @return a pointer to the contents if the library is mapped in memory
+   *         (i.e. not encrypted), and a null pointer otherwise.
+   * @note The view is valid as long as this library is open.
+   */
+  const char *GetView(off_t offset, size_t size) const noexcept;
+  /**
+   * @brief Returns a read-only view of the whole file contents.
+   * @see GetView(off_t, size_t)
+   */
+  const char *GetView() const noexcept {
+    return IsFile() ? GetView(0, GetSize()) : nullptr;
+  }
+
+  /**
+   * @brief Returns the reader of the library which this entry belongs to.
+   * @return a shared pointer to the reader.
+   */
+  const std::shared_ptr<Reader>& reader() const noexcept {
+    return reader_;
+  }
+
+  /**
+   * @brief Returns the offset of this file contents in the library.
+   * @return the offset of this file contents from the beginning of the reader.
+   */
+  off_t GetBaseOffset() const noexcept {
+    return GetFileBaseOffset();
+  }
+
+  /**
+   * @brief Returns a lightweight handle of this entry.
+   *        The entry table of the archive is built at the first call.
+   * @return a handle which is valid while this entry is open,
+   *         or an invalid handle if this entry is not open.
+   * @see EntryRef
+   */
+  EntryRef GetEntryRef() noexcept;
+
   /**
    * @brief Returns the current file position of this entry.
    * @return the current file position of this entry.
@@ -363,11 +430,15 @@ protected:
   virtual const char *GetChildNameAsCharArray(size_t i) const noexcept = 0;
   virtual MLib *CreateChild(size_t i) noexcept = 0;
   virtual off_t GetFileBaseOffset() const noexcept = 0;
+  // fill the table with all entries of the archive (called on the root)
+  virtual void FillEntryTable(EntryTable *table) noexcept = 0;
 
 private:
   const MLibPtr GetOrCreateChild(size_t i) noexcept;
+  MLibPtr Child(const char *name, size_t length) noexcept;
   MLibPtr GetEntry(const std::string &path, size_t index) noexcept;
   void LoadChildInfo();
+  static MLibPtr DoOpen(const std::string &filename, const std::string &product);
 
   bool verbose_;
   std::weak_ptr<MLib> self_;
@@ -375,11 +446,13 @@ private:
   std::string libname_;
   std::string location_;
   std::vector< std::weak_ptr<MLib> > children_;
-  std::map<std::string, size_t> child_name2index_;
+  std::mutex children_mutex_;  // guards children_
+  std::once_flag child_info_loaded_;
+  FlatIndex child_index_;  // child names to child indices
   std::shared_ptr<Reader> reader_;
   off_t file_pos_;
-
-  static std::map< std::string, std::weak_ptr<MLib> > opened_libs_;
+  std::shared_ptr<EntryTable> entry_table_;  // of the root only
+  std::once_flag entry_table_built_;
 };
 
 ////////////////////////////////////////////////////////////////////////
@@ -420,6 +493,7 @@ protected:
   const char *GetChildNameAsCharArray(size_t i) const noexcept override;
   MLib *CreateChild(size_t i) noexcept override;
   off_t GetFileBaseOffset() const noexcept override;
+  void FillEntryTable(EntryTable *table) noexcept override;
 
 private:
   struct LIBHDR {
@@ -483,6 +557,7 @@ protected:
   const char *GetChildNameAsCharArray(size_t i) const noexcept override;
   MLib *CreateChild(size_t i) noexcept override;
   off_t GetFileBaseOffset() const noexcept override;
+  void FillEntryTable(EntryTable *table) noexcept override;
 
 private:
   struct LIBUHDR {
@@ -500,9 +575,12 @@ private:
   };
 
   LIBU_t(LIBU_t* parent, const LIBUENTRY &entry_info);
+  // convert a UTF-16 entry name into UTF-8
+  static std::string DecodeName(const LIBUENTRY &entry);
 
   LIBUHDR hdr_;
   std::vector<LIBUENTRY> entries_;
+  std::vector<std::string> child_names_;  // converted into UTF-8
   std::string name_;
   off_t offset_;
   size_t file_size_;
@@ -544,6 +622,7 @@ protected:
   const char *GetChildNameAsCharArray(size_t i) const noexcept override;
   MLib *CreateChild(size_t i) noexcept override;
   off_t GetFileBaseOffset() const noexcept override;
+  void FillEntryTable(EntryTable *table) noexcept override;
 
 private:
   struct LIBPHDR {
@@ -578,6 +657,104 @@ private:
   const std::string name_;
 };
 
+////////////////////////////////////////////////////////////////////////
+/// @brief MLIDX_t class
+///
+/// An archive tree loaded from an index file (archive + ".mlidx") instead
+/// of the headers in the archive. The index stores the resolved tree in
+/// breadth-first order with absolute offsets, sizes and names, and is
+/// valid while the size, mtime and key of the archive match it. The file
+/// contents are still read through the reader of the archive.
+////////////////////////////////////////////////////////////////////////
+
+class MLIDX_t : public MLib {
+public:
+  /**
+   * @brief Open the index of an archive.
+   * @param[in] lib_name the archive filename.
+   * @param[in] product a product code name.
+   * @param[in] reader a reader of the archive. it is owned by the returned entry.
+   * @return a pointer to the root entry if the index is valid, and a null pointer otherwise.
+   */
+  static MLIDX_t *Load(const std::string &lib_name, const std::string &product, Reader *reader);
+
+  /**
+   * @brief Write the index of an archive.
+   * @param[in] lib_name the archive filename.
+   * @param[in] product a product code name.
+   * @return true if success, and false otherwise.
+   */
+  static bool Write(const std::string &lib_name, const std::string &product);
+
+  /**
+   * @brief Returns the index filename of an archive.
+   */
+  static std::string GetIndexFilename(const std::string &lib_name);
+
+  ~MLIDX_t();
+
+  /**
+   * @see MLib::name()
+   */
+  const std::string &name() const noexcept override {
+    return name_;
+  }
+
+  /**
+   * @see Entry::IsFile()
+   */
+  bool IsFile() const noexcept override;
+
+  /**
+   * @see Entry::GetSize()
+   */
+  size_t GetSize() const noexcept override final;
+
+  /**
+   * @see MLib::GetChildNumber()
+   */
+  unsigned int GetChildNumber() const noexcept override;
+
+protected:
+  void DoLoadChildInfo() noexcept override {}
+  const char *GetChildNameAsCharArray(size_t i) const noexcept override;
+  MLib *CreateChild(size_t i) noexcept override;
+  off_t GetFileBaseOffset() const noexcept override;
+  void FillEntryTable(EntryTable *table) noexcept override;
+
+private:
+  struct IndexHeader {
+    char signature[4];     // "MLIX"
+    uint32_t version;
+    uint32_t node_count;
+    uint32_t names_size;
+    uint64_t archive_size;
+    int64_t mtime_sec;
+    int64_t mtime_nsec;
+    uint64_t key_hash;     // a hash of the cipher type, key and data alignment
+  };
+
+  typedef EntryTable::Node IndexNode;
+
+  struct SharedObject {
+    void *addr_;
+    size_t length_;
+    const IndexHeader *hdr_;
+    const IndexNode *nodes_;
+    const char *names_;
+  public:
+    SharedObject() : addr_(nullptr), length_(0), hdr_(nullptr), nodes_(nullptr), names_(nullptr) {}
+    ~SharedObject();
+  };
+
+  MLIDX_t(const std::string &lib_name, Reader *reader, const std::shared_ptr<SharedObject> &shobj);
+  MLIDX_t(const std::shared_ptr<SharedObject> &shobj, MLIDX_t *parent, unsigned int node_index);
+
+  std::shared_ptr<SharedObject> shobj_;
+  const unsigned int node_index_;
+  const std::string name_;
+};
+
 ////////////////////////////////////////////////////////////////////////
 /// @brief OSEntry class
 ////////////////////////////////////////////////////////////////////////
@@ -591,6 +768,8 @@ public:
 
 ////////////////////////////////////////////////////////////////////////
 /// @brief OSFile class
+///
+/// An OSFile has a file position, so it is used by one thread at a time.
 ////////////////////////////////////////////////////////////////////////
 
 class OSFile : public OSEntry {
@@ -613,10 +792,15 @@ public:
 private:
   FILE *fp_;
   std::string name_;
+  size_t size_;  // by stat(2) when opened
 };
 
 ////////////////////////////////////////////////////////////////////////
 /// @brief OSDirectory class
+///
+/// The listing of a directory is read once into a hash map and shared by
+/// the lookups until the directory is modified. The const functions may
+/// be called from several threads.
 ////////////////////////////////////////////////////////////////////////
 
 class OSDirectory : public OSEntry {
@@ -647,14 +831,31 @@ public:
   OSEntry* OpenChild(const std::string& child_name) const noexcept;
   std::vector<OSEntry*> GetChildren() const noexcept;
 private:
+  struct Snapshot;
+  // the listing of this directory, read again when its mtime changes
+  std::shared_ptr<const Snapshot> GetSnapshot() const noexcept;
+  OSEntry* OpenChild(const std::string& child_name, bool is_directory) const noexcept;
+
   DIR *dirp_;
   std::string name_;
+  mutable std::shared_ptr<const Snapshot> snapshot_;
+  mutable std::mutex snapshot_mutex_;
 };
 
 ////////////////////////////////////////////////////////////////////////
 /// @brief Versioned entry class
+///
+/// A versioned entry is used by one thread at a time. Entries of the same
+/// path share their MLib entries, so each versioned entry keeps its own
+/// position and reads them with positional reads. Separate entries may be
+/// used in parallel that way, but the position of the MLib entry returned
+/// by GetCurrentMLib() is shared, and its Seek() and sequential Read()
+/// must not be used by several threads.
 ////////////////////////////////////////////////////////////////////////
 
+class OverlayIndex;
+class ArchiveSetSnapshot;
+
 class VersionedEntry : public Entry {
 protected:
   VersionedEntry();
@@ -677,14 +878,37 @@ public:
   size_t GetSize() const noexcept override;
   off_t Seek(off_t offset, int whence) noexcept override;
   size_t Read(size_t size, void* dest) noexcept(false) override;
+  const char* GetView() const noexcept;
+  MLib* GetCurrentMLib() const noexcept;
   VersionedEntry* OpenChild(const std::string& child_name) const noexcept;
   std::vector<VersionedEntry*> GetChildren() const noexcept;
+  /**
+   * @brief Returns an immutable view of the archive set of this directory at a version,
+   *        whose paths are relative to this entry. This entry may be closed after it.
+   * @param[in] version a version of the set (see ArchiveSetSnapshot).
+   * @return the view, or an invalid one if this is not a directory in an archive set.
+   */
+  ArchiveSetSnapshot GetSnapshot(int version) const noexcept;
 private:
+  // open the versions of a child node of the overlay index from the versions of its parent.
+  // returns false if some of them could not be opened.
+  bool OpenOverlayChild(uint32_t parent, const std::vector<MLibPtr>& parent_history,
+                        uint32_t node, std::vector<MLibPtr>* history) const noexcept;
+  // find the archive versions of a relative path, and its node of the overlay index
+  // if it has one. the results are kept in a process-wide LRU cache.
+  void ResolveChild(const std::string& path, std::vector<MLibPtr>* history,
+                    uint32_t* overlay_node) const noexcept;
+
   OSEntry* p_os_entry_;
   std::vector<MLibPtr> mlib_entries_;
   std::string name_;
   Entry* p_curr_;
   int curr_ver_;
+  off_t pos_;  // the position in the current version if it is an archive entry
+  // the union of the versions of the archive set, shared by the entries
+  // in it, and the node of this entry (mlib_entries_ are its versions)
+  std::shared_ptr<const OverlayIndex> overlay_;
+  uint32_t overlay_node_;
 };
 
 
@@ -695,11 +919,26 @@ private:
 size_t UTF16ToUTF8(const char *src, char *dst);
 std::string UTF16ToUTF8(const char16_t *src, size_t length);
 std::string UTF16ToUTF8(const std::u16string &src);
+// the absolute path without "." and "..". the working directory is read once.
 std::string GenerateFullPath(const std::string &path);
 Reader *CreateReader(const std::string &filename, const std::string &product);
+Encrypter *CreateEncrypter(const std::string &product);
+// keep decrypted copies of archives in dir (empty to disable, see ShadowCache)
+// call it and LoadKeyInfo() before other threads use the library
+void SetShadowCacheDirectory(const std::string &dir);
+// close the archives which VersionedEntry keeps open to find the versions.
+// a directory is scanned for archives again when its mtime changes.
+void ClearArchiveSetCache();
+// set the count of paths whose archive versions VersionedEntry::OpenChild() keeps
+// (0 to disable). hits and misses are counted in Stats.
+void SetPathCacheCapacity(size_t count);
 bool LoadKeyInfo(const std::string &csv);
 bool FindKeyInfo(const std::string &product, const KeyInfo **dest);
 void PrintKeyInfo();
 unsigned int GetDataAlignment(const std::string &product);
+// write the index file of an archive which MLib::Open() loads instead of its headers
+bool WriteIndex(const std::string &filename, const std::string &product);
+// try every key in the key info against an archive, best candidates first
+std::vector<ProductCandidate> DetectProduct(const std::string &filename);
 
 } //namespace mlib
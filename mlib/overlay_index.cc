@@ -0,0 +1,172 @@
+/* overlay_index.cc (updated on 2018/05/26)
+ * Copyright (C) 2018 renny1398.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ */
+
+#include <cstring>
+#include <algorithm>
+#include "overlay_index.h"
+
+namespace {
+
+// compare a NUL-terminated name with a name of length bytes
+int compare_name(const char *lhs, const char *rhs, size_t length) {
+  const int ret = ::strncmp(lhs, rhs, length);
+  if (ret != 0) return ret;
+  return (lhs[length] == '\0') ? 0 : 1;
+}
+
+} // namespace
+
+namespace mlib {
+
+const uint32_t OverlayIndex::npos;
+
+////////////////////////////////////////////////////////////////////////
+// OverlayIndex Class Function Definitions
+////////////////////////////////////////////////////////////////////////
+
+std::shared_ptr<const OverlayIndex> OverlayIndex::Build(const std::vector<MLibPtr> &layers) {
+  std::shared_ptr<OverlayIndex> index(new OverlayIndex());
+  index->layers_ = layers;
+  Node root = {};
+  index->names_.append(1, '\0');
+  for (uint32_t layer = 0; layer < layers.size(); ++layer) {
+    const EntryRef entry = layers[layer]->GetEntryRef();
+    if ( !entry ) continue;
+    index->versions_.push_back(Version{layer, entry});
+    ++root.version_count;
+  }
+  index->nodes_.push_back(root);
+
+  // breadth first, so that the children of a node are contiguous
+  struct Item {
+    const char *name;
+    Version version;
+  };
+  std::vector<Item> items;
+  for (uint32_t i = 0; i < index->nodes_.size(); ++i) {
+    items.clear();
+    const Node node = index->nodes_[i];
+    for (uint32_t j = 0; j < node.version_count; ++j) {
+      const Version &v = index->versions_[node.first_version + j];
+      if ( !v.entry.IsDirectory() ) continue;
+      for (const EntryRef child : v.entry.children()) {
+        items.push_back(Item{child.name(), Version{v.layer, child}});
+      }
+    }
+    // stable, so that the versions of a name stay the latest first
+    std::stable_sort(items.begin(), items.end(), [](const Item &lhs, const Item &rhs) {
+      return ::strcmp(lhs.name, rhs.name) < 0;
+    });
+    const uint32_t first_child = static_cast<uint32_t>(index->nodes_.size());
+    for (size_t k = 0; k < items.size(); ++k) {
+      if (k == 0 || ::strcmp(items[k - 1].name, items[k].name) != 0) {
+        Node child = {};
+        child.name_offset = static_cast<uint32_t>(index->names_.size());
+        child.first_version = static_cast<uint32_t>(index->versions_.size());
+        index->names_.append(items[k].name, ::strlen(items[k].name) + 1);
+        index->nodes_.push_back(child);
+      } else if (items[k - 1].version.layer == items[k].version.layer) {
+        // a name twice in one directory of a layer: the last entry wins,
+        // as FlatIndex resolves it, so a layer has one version per node
+        index->versions_.back() = items[k].version;
+        continue;
+      }
+      index->versions_.push_back(items[k].version);
+      ++index->nodes_.back().version_count;
+    }
+    index->nodes_[i].first_child = first_child;
+    index->nodes_[i].child_count = static_cast<uint32_t>(index->nodes_.size()) - first_child;
+  }
+  return index;
+}
+
+uint32_t OverlayIndex::Child(uint32_t i, const char *name, size_t length) const noexcept {
+  const Node &parent = nodes_[i];
+  uint32_t first = parent.first_child;
+  uint32_t last = first + parent.child_count;
+  while (first < last) {
+    const uint32_t mid = first + (last - first) / 2;
+    const int ret = compare_name(this->name(mid), name, length);
+    if (ret == 0) return mid;
+    if (ret < 0) {
+      first = mid + 1;
+    } else {
+      last = mid;
+    }
+  }
+  return npos;
+}
+
+uint32_t OverlayIndex::Find(const std::string &path, uint32_t i) const noexcept {
+  if (nodes_.size() <= i) return npos;
+  size_t index = 0;
+  while (i != npos && index < path.size()) {
+    size_t delim_pos = path.find_first_of("/\\", index);
+    if (delim_pos == std::string::npos) delim_pos = path.size();
+    if (index < delim_pos) {
+      i = Child(i, path.data() + index, delim_pos - index);
+    }
+    index = delim_pos + 1;
+  }
+  return i;
+}
+
+////////////////////////////////////////////////////////////////////////
+// ArchiveSetSnapshot Class Function Definitions
+////////////////////////////////////////////////////////////////////////
+
+ArchiveSetSnapshot::ArchiveSetSnapshot(const std::shared_ptr<const OverlayIndex> &index,
+                                       uint32_t root, int version) noexcept
+  : index_(index), root_(root), version_(0), first_layer_(0) {
+  const int latest = GetLatestVersion();
+  if (latest == 0) return;
+  if (version < 0) version += latest + 1;
+  version_ = std::max(1, std::min(version, latest));
+  // layers are the latest first, so the version has the last version_ layers
+  first_layer_ = static_cast<uint32_t>(latest - version_);
+}
+
+uint32_t ArchiveSetSnapshot::Find(const std::string &path) const noexcept {
+  if (index_ == nullptr) return OverlayIndex::npos;
+  // a node is in this version if one of its versions is, and then so are its parents
+  const uint32_t node = index_->Find(path, root_);
+  return Visible(node) ? node : OverlayIndex::npos;
+}
+
+std::vector<uint32_t> ArchiveSetSnapshot::GetChildren(uint32_t node) const {
+  std::vector<uint32_t> children;
+  if ( !Resolve(node).IsDirectory() ) return children;
+  const OverlayIndex::Node &parent = index_->node(node);
+  children.reserve(parent.child_count);
+  for (uint32_t i = parent.first_child; i < parent.first_child + parent.child_count; ++i) {
+    if (Visible(i)) children.push_back(i);
+  }
+  return children;
+}
+
+EntryRef ArchiveSetSnapshot::Resolve(uint32_t node) const noexcept {
+  if (index_ == nullptr || node >= index_->size()) return EntryRef();
+  const uint32_t version_count = index_->node(node).version_count;
+  for (uint32_t j = 0; j < version_count; ++j) {
+    const OverlayIndex::Version &v = index_->version(node, j);
+    if (first_layer_ <= v.layer) return v.entry;
+  }
+  return EntryRef();
+}
+
+} // namespace mlib
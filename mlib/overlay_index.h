@@ -0,0 +1,178 @@
+#pragma once
+
+/* overlay_index.h (updated on 2018/05/25)
+ * Copyright (C) 2018 renny1398.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ */
+
+#include <stdint.h>
+#include <stddef.h>
+#include <memory>
+#include <string>
+#include <vector>
+#include "mlib.h"
+
+namespace mlib {
+
+////////////////////////////////////////////////////////////////////////
+/// @brief OverlayIndex class
+///
+/// The union of the entries of several versions (layers) of an archive
+/// set, built once. Each node is a path which some layers have, with the
+/// versions of it from the latest layer to the oldest. The children of a
+/// node are the contiguous nodes [first_child, first_child + child_count)
+/// sorted by name. An index never changes after it is built, so it can be
+/// shared by entries on several threads.
+////////////////////////////////////////////////////////////////////////
+
+class OverlayIndex {
+public:
+  struct Version {
+    uint32_t layer;  // an index of the layers (0 is the latest)
+    EntryRef entry;
+  };
+
+  struct Node {
+    uint32_t name_offset;  // a NUL-terminated name in the name table
+    uint32_t first_child;
+    uint32_t child_count;
+    uint32_t first_version;
+    uint32_t version_count;
+  };
+
+  static const uint32_t npos = 0xffffffff;
+
+  /**
+   * @brief Build the index of layers.
+   * @param[in] layers the roots of the versions, the latest first.
+   *            They are kept open while the index is alive.
+   * @return the index, whose node 0 is the root.
+   */
+  static std::shared_ptr<const OverlayIndex> Build(const std::vector<MLibPtr> &layers);
+
+  uint32_t size() const noexcept { return static_cast<uint32_t>(nodes_.size()); }
+  const Node &node(uint32_t i) const noexcept { return nodes_[i]; }
+  const char *name(uint32_t i) const noexcept { return &names_[nodes_[i].name_offset]; }
+  const std::vector<MLibPtr> &layers() const noexcept { return layers_; }
+
+  /**
+   * @brief Returns the jth version of a node (0 <= j < version_count).
+   */
+  const Version &version(uint32_t i, uint32_t j) const noexcept {
+    return versions_[nodes_[i].first_version + j];
+  }
+  /**
+   * @brief Returns the latest version of a node.
+   */
+  const Version &latest(uint32_t i) const noexcept {
+    return versions_[nodes_[i].first_version];
+  }
+
+  /**
+   * @brief Find a child of a node by its name.
+   * @return the index of the child if found, and npos otherwise.
+   */
+  uint32_t Child(uint32_t i, const char *name, size_t length) const noexcept;
+  /**
+   * @brief Find a node by a path separated with '/' or '\\'.
+   * @param[in] i the node which the path is relative to (default: the root).
+   * @return the index of the node if found, and npos otherwise.
+   */
+  uint32_t Find(const std::string &path, uint32_t i = 0) const noexcept;
+
+private:
+  OverlayIndex() = default;
+  OverlayIndex(const OverlayIndex &) = delete;
+  OverlayIndex &operator=(const OverlayIndex &) = delete;
+
+  std::vector<MLibPtr> layers_;
+  std::vector<Node> nodes_;
+  std::vector<Version> versions_;
+  std::string names_;
+};
+
+////////////////////////////////////////////////////////////////////////
+/// @brief ArchiveSetSnapshot class
+///
+/// A view of an archive set at one version, where every path is resolved
+/// to the latest entry among the layers up to that version. It is a
+/// copyable handle of an overlay index with no cursor, and the entries it
+/// returns are read with positional reads, so views of several versions
+/// may be used from several threads at once.
+/// Versions count the layers of the set: 1 is the oldest archive alone,
+/// and GetLatestVersion() has all of them. OS files are not in a view.
+////////////////////////////////////////////////////////////////////////
+
+class ArchiveSetSnapshot {
+public:
+  ArchiveSetSnapshot() noexcept : root_(OverlayIndex::npos), version_(0), first_layer_(0) {}
+  /**
+   * @brief A constructor.
+   * @param[in] index the overlay index of the set.
+   * @param[in] root the node which the paths are relative to.
+   * @param[in] version a version (1 <= version <= GetLatestVersion()), or a version
+   *            from the latest if negative (-1 is the latest, as in VersionedEntry::SwitchVersion()).
+   */
+  ArchiveSetSnapshot(const std::shared_ptr<const OverlayIndex> &index, uint32_t root, int version) noexcept;
+
+  /**
+   * @brief Check whether this is a view of an archive set.
+   */
+  explicit operator bool() const noexcept { return index_ != nullptr; }
+  int GetVersion() const noexcept { return version_; }
+  int GetLatestVersion() const noexcept {
+    return index_ ? static_cast<int>(index_->layers().size()) : 0;
+  }
+
+  /**
+   * @brief Returns the entry of a path in this version.
+   * @param[in] path a path relative to the root separated with '/' or '\\'.
+   * @return the entry if the path is in this version, and an invalid handle otherwise.
+   */
+  EntryRef GetEntry(const std::string &path) const noexcept {
+    return Resolve(Find(path));
+  }
+
+  /**
+   * @brief Find the node of a path in this version.
+   * @return the node if the path is in this version, and OverlayIndex::npos otherwise.
+   */
+  uint32_t Find(const std::string &path) const noexcept;
+  /**
+   * @brief Returns the node of the root, which is OverlayIndex::npos if not in this version.
+   */
+  uint32_t root() const noexcept { return Visible(root_) ? root_ : OverlayIndex::npos; }
+  /**
+   * @brief Returns the children of a node in this version, sorted by name.
+   */
+  std::vector<uint32_t> GetChildren(uint32_t node) const;
+  const char *name(uint32_t node) const noexcept { return index_->name(node); }
+  /**
+   * @brief Returns the entry of a node in this version.
+   * @return the entry, or an invalid handle if the node is not in this version.
+   */
+  EntryRef Resolve(uint32_t node) const noexcept;
+
+private:
+  bool Visible(uint32_t node) const noexcept { return static_cast<bool>(Resolve(node)); }
+
+  std::shared_ptr<const OverlayIndex> index_;
+  uint32_t root_;
+  int version_;
+  uint32_t first_layer_;  // the latest layer in this version
+};
+
+} // namespace mlib
@@ -19,6 +19,7 @@
 // require for low-level file control
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/mman.h>
 #include <fcntl.h>
 
 #include <unistd.h>
@@ -29,6 +30,8 @@
 #include <cstdio>
 #include <cassert>
 #include "reader.h"
+#include "block_cache.h"
+#include "stats.h"
 
 namespace {
 inline unsigned int rotl(unsigned int data, unsigned int bits) {
@@ -37,18 +40,25 @@ inline unsigned int rotl(unsigned int data, unsigned int bits) {
 inline unsigned int rotr(unsigned int data, unsigned int bits) {
  return (data >> bits) | (data << (32 - bits));
 }
+
+// pread(2) with statistics
+ssize_t stat_pread(int fd, void *buf, size_t count, off_t offset) {
+  const ssize_t ret = ::pread(fd, buf, count, offset);
+  mlib::Stats &stats = mlib::Stats::GetInstance();
+  stats.Add(mlib::Stats::kSyscalls);
+  if (ret > 0) stats.Add(mlib::Stats::kBytesRead, ret);
+  return ret;
+}
 } // namespace
 
 namespace mlib {
 
-bool Reader::verbose_ = false;
+std::atomic<bool> Reader::verbose_(false);
 
 streambuf_base::streambuf_base()
-    : std::streambuf(), fd_(-1), file_size_(0UL) {
+    : fd_(-1), file_size_(0UL), file_id_() {
   static_assert(kBufferSize % 16 == 0, "invalid buffer size");
-  // setg(buff_, nullptr, buff_ + sizeof(buff_));
-  setg(nullptr, nullptr, nullptr);
-  setp(nullptr, nullptr);
+  static_assert(kBufferSize == BlockCache::kBlockSize, "buffer size must equal cache block size");
 }
 
 streambuf_base::~streambuf_base() {
@@ -61,8 +71,10 @@ streambuf_base *streambuf_base::open(const std::string &filename) {
   if (fd_ != -1) close();
   struct stat st;
   ::fstat(fd, &st);
+  Stats::GetInstance().Add(Stats::kSyscalls, 2);
   fd_ = fd;
   file_size_ = st.st_size;
+  file_id_ = BlockCache::MakeFileIdentity(st, cache_tag_.data(), cache_tag_.size());
   return this;  
 }
 
@@ -81,288 +93,248 @@ size_t streambuf_base::size() const {
   return file_size_;
 }
 
-streambuf_base *streambuf_base::setbuf(char *, std::streamsize) {
-  return this;
+void streambuf_base::set_cache_tag(const void *tag, size_t length) {
+  cache_tag_.assign(static_cast<const char *>(tag), length);
 }
 
-std::streampos streambuf_base::seekoff(std::streamoff off,
-                                       std::ios_base::seekdir way,
-                                       std::ios_base::openmode which) {
-  if ( (which & std::ios_base::in) != std::ios_base::in ) {
-    return std::streampos(std::streamoff(-1));
-  }
-  const auto prev_pos = calculate_pos();
-  // convert 'off' into the absolute position
-  switch (way) {
-  case std::ios_base::beg:
-    break;
-  case std::ios_base::cur:
-    off += prev_pos;
-    break;
-  case std::ios_base::end:
-    off += file_size_;
-    break;
-  default:
-    return std::streampos(std::streamoff(-1));
-  }
-  const auto new_pos = ::lseek(fd_, off, SEEK_SET);
-  if (new_pos == -1) {
-    setg(nullptr, nullptr, nullptr);
-    return std::streampos(new_pos);
+std::streamsize streambuf_base::readat(off_t pos, char *s, std::streamsize n) {
+  if (fd_ == -1 || s == nullptr || pos < 0) return 0;
+  if (pos >= static_cast<off_t>(file_size_)) return 0;
+  n = std::min(n, static_cast<std::streamsize>(file_size_ - pos));
+  if (n >= kBufferSize) {
+    return readat_direct(pos, s, n);
   }
-  if (new_pos == prev_pos) {
-#if 0
-    std::cerr << "mlib::streambuf: WARNING: the file position doesn't need to be changed."
-              << " (pos = " << new_pos << ")" << std::endl;
-#endif
-    return std::streampos(new_pos);
-  }
-#if 0
-  std::cerr << "mlib::streambuf: seeked to " << new_pos << "." << std::endl;
-#endif
-  const auto prev_gindex = prev_pos % kBufferSize;
-  const auto prev_aligned_pos = prev_pos - prev_gindex;
-  const auto new_gindex = new_pos % kBufferSize;
-  const auto new_aligned_pos = new_pos - new_gindex; 
-  if (prev_aligned_pos != new_aligned_pos) {
-    setg(nullptr, nullptr, nullptr);
-  } else {
-    setg(eback(), eback() + new_gindex, egptr());
-  }
-  return std::streampos(new_pos);
-}
-
-std::streampos streambuf_base::seekpos(std::streampos pos,
-                                       std::ios_base::openmode which) {
-  return seekoff(pos, std::ios_base::beg, which);
-}
-
-std::streamsize streambuf_base::xsgetn(char *s, std::streamsize n) {
-  if (fd_ == -1 || s == nullptr) return 0;
+  // small reads are served block by block through the block cache
+  char block[kBufferSize];
   std::streamsize read_bytes = 0;
   while (read_bytes < n) {
-    if (gptr() == nullptr || gptr() >= egptr()) {
-      int c = underflow();
-      if (c == EOF) break;
-    }
-    assert(gptr() != nullptr);
-    auto to_read_bytes = std::min(egptr() - gptr(), n - read_bytes);
-#if 0
-    std::cerr << "mlib::streambuf: memcpy(" << (void*)s <<  ", "
-              << (void*)gptr() << ", " << to_read_bytes << ")." << std::endl;
-#endif
-    ::memcpy(s + read_bytes, gptr(), to_read_bytes);
-    gbump(to_read_bytes);
+    const off_t curr_pos = pos + read_bytes;
+    const auto index = curr_pos % kBufferSize;
+    const auto block_bytes = load_block(curr_pos - index, block);
+    if (block_bytes <= index) break;
+    const auto to_read_bytes = std::min(block_bytes - index, n - read_bytes);
+    ::memcpy(s + read_bytes, block + index, to_read_bytes);
     read_bytes += to_read_bytes;
   }
   return read_bytes;
 }
 
-int streambuf_base::underflow() {
-  auto pos = calculate_pos();
-  if (pos == -1 || pos >= static_cast<off_t>(file_size_)) {
-    return EOF;
-  }
-#if 0
-  std::cerr << "mlib::streambuf starts underflow()."
-            << " (eback = " << (void*)eback() << ", gptr = " << (void*)gptr()
-            << ", egptr = " << (void*)egptr() << ")" << std::endl;
-  std::cerr << "mlib::streambuf: calculated pos: the value is " << pos << std::endl;
-#endif
-  const auto gindex = pos % kBufferSize;
-  off_t gpos = pos - gindex;
-  gpos = ::lseek(fd_, gpos, SEEK_SET);
-  if (gpos == -1) {
-    std::cerr << "mlib::streambuf::underflow(): lseek error." << std::endl;
-    return EOF;
+std::streamsize streambuf_base::load_block(off_t block_pos, char *buf) {
+  assert(block_pos % kBufferSize == 0);
+  // decoded blocks are shared with other readers through the block cache
+  BlockCache &cache = BlockCache::GetInstance();
+  const uint64_t block_index = block_pos / kBufferSize;
+  std::streamsize read_bytes = cache.Lookup(file_id_, block_index, buf);
+  if (read_bytes != 0) return read_bytes;
+  read_bytes = stat_pread(fd_, buf, kBufferSize, block_pos);
+  if (read_bytes <= 0) return 0;
+  rewrite_buffer(block_pos, buf, read_bytes);
+  cache.Insert(file_id_, block_index, buf, read_bytes);
+  return read_bytes;
+}
+
+std::streamsize streambuf_base::readat_direct(off_t pos, char *s, std::streamsize n) {
+  std::streamsize read_bytes = 0;
+  char block[16];
+  // the leading partial block
+  const auto head = pos % 16;
+  if (head != 0) {
+    const off_t block_pos = pos - head;
+    const auto block_bytes = stat_pread(fd_, block, 16, block_pos);
+    if (block_bytes <= head) return 0;
+    rewrite_buffer(block_pos, block, 16);
+    read_bytes = std::min(static_cast<std::streamsize>(block_bytes - head), n);
+    ::memcpy(s, block + head, read_bytes);
   }
-  const auto read_bytes = ::read(fd_, buf_, kBufferSize);
-#if 0
-  if (read_bytes < kBufferSize) {
-    std::cerr << "mlib::streambuf::underflow(): reach EOF. (read "
-              << read_bytes << " bytes from " << gpos << ")" << std::endl;
+  // the aligned blocks are decoded in the destination buffer
+  const std::streamsize body = (n - read_bytes) & ~static_cast<std::streamsize>(15);
+  if (body > 0) {
+    std::streamsize body_bytes = 0;
+    while (body_bytes < body) {
+      const auto ret = stat_pread(fd_, s + read_bytes + body_bytes,
+                                  body - body_bytes, pos + read_bytes + body_bytes);
+      if (ret <= 0) break;
+      body_bytes += ret;
+    }
+    if (body_bytes < body) {
+      std::cerr << "mlib::streambuf::readat(): read error." << std::endl;
+      body_bytes &= ~static_cast<std::streamsize>(15);
+      rewrite_buffer(pos + read_bytes, s + read_bytes, body_bytes);
+      return read_bytes + body_bytes;
+    }
+    rewrite_buffer(pos + read_bytes, s + read_bytes, body);
+    read_bytes += body;
   }
-#endif
-  if (read_bytes == -1 || gindex >= read_bytes) {
-    std::cerr << "mlib::streambuf::underflow(): unknown error." << std::endl;
-    return EOF;
+  // the trailing partial block
+  if (read_bytes < n) {
+    const off_t block_pos = pos + read_bytes;
+    const auto block_bytes = stat_pread(fd_, block, 16, block_pos);
+    if (block_bytes <= 0) return read_bytes;
+    rewrite_buffer(block_pos, block, 16);
+    const auto tail = std::min(static_cast<std::streamsize>(block_bytes), n - read_bytes);
+    ::memcpy(s + read_bytes, block, tail);
+    read_bytes += tail;
   }
-  ::lseek(fd_, gpos, SEEK_SET);
-  setg(buf_, buf_ + gindex, buf_ + read_bytes);
-  rewrite_buffer(gpos, eback(), read_bytes);
-#if 0
-  std::cerr << "mlib::streambuf ends underflow() successfully."
-            << " (buffered size = " << read_bytes << ", gindex = " << gindex << ")" << std::endl;
-#endif
-  // convert CHAR(-1) into not INT(-1) (means EOF) but INT(255)
-  return *reinterpret_cast<unsigned char *>(gptr());
-}
-
-int streambuf_base::uflow() {
-  int c = underflow();
-  if (c == EOF) return EOF;
-  gbump(1);
-  return c;
-}
-
-int streambuf_base::overflow(int) {
-  return EOF;
+  return read_bytes;
 }
 
-off_t streambuf_base::calculate_pos() {
-  if (fd_ == -1) return -1;
-  auto fd_pos = ::lseek(fd_, 0, SEEK_CUR);
-  if (fd_pos == -1) return -1;
-  auto pos = (gptr() == nullptr) ? fd_pos :
-             (fd_pos - (fd_pos % kBufferSize)) + (gptr() - eback());
-  return pos;
+void camelliabuf::rewrite_buffer(off_t pos, char *buf, std::streamsize n) {
+  assert(pos % 16 == 0);
+  assert(n % 16 == 0);
+  Stats::Timer timer(Stats::kDecryptNanoseconds);
+  Stats::GetInstance().Add(Stats::kBytesDecrypted, n);
+  CamelliaDecode(key_table_, pos, buf, n);
 }
 
-void camelliabuf::rewrite_buffer(off_t pos, char *buf, std::streamsize n) {
+void CamelliaDecode(const KEY_TABLE_TYPE key_table, off_t pos, char *buf, size_t n) {
   assert(pos % 16 == 0);
   assert(n % 16 == 0);
   auto block_pos = pos >> 4; // (pos / 16)
   auto block_count = n >> 4; // (n / 16)
-  unsigned char cipher[16];
-  unsigned char *plaintext = reinterpret_cast<unsigned char *>(buf);
-  const unsigned int *p = reinterpret_cast<const unsigned int *>(buf);
-  unsigned int *const q = reinterpret_cast<unsigned int *>(cipher);
+  // undo the rotation of the whole buffer first, then decrypt the blocks
+  // at once so that the multi-block kernel can be used
+  unsigned int *p = reinterpret_cast<unsigned int *>(buf);
   int roll_bits = (block_pos & 0x0f) | 0x10;
   for (decltype(block_count) i = 0; i < block_count; ++i) {
-    q[0] = rotl(p[0], roll_bits);
-    q[1] = rotr(p[1], roll_bits);
-    q[2] = rotl(p[2], roll_bits);
-    q[3] = rotr(p[3], roll_bits);
-    Camellia_DecryptBlock(128, cipher, key_table_, plaintext);
+    p[0] = rotl(p[0], roll_bits);
+    p[1] = rotr(p[1], roll_bits);
+    p[2] = rotl(p[2], roll_bits);
+    p[3] = rotr(p[3], roll_bits);
     p += 4;
-    plaintext += 16;
     roll_bits = ((roll_bits + 1) & 0x0f) | 0x10;
   }
+  unsigned char *text = reinterpret_cast<unsigned char *>(buf);
+  Camellia_DecryptBlocks(128, text, key_table, text, block_count);
 }
 
 void crypto2buf::rewrite_buffer(off_t pos, char *buf, std::streamsize n) {
   assert(pos % 16 == 0);
   assert(n % 16 == 0);
+  Stats::Timer timer(Stats::kDecryptNanoseconds);
+  Stats::GetInstance().Add(Stats::kBytesDecrypted, n);
+  Crypto2_DecryptBlocks(key_table_, pos >> 4,
+                        reinterpret_cast<unsigned char *>(buf), n >> 4);
+}
 
-  static const unsigned char rotate_table[0x20] = {
-    0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x09,
-    0x0A, 0x0B, 0x0C, 0x0D, 0x0E, 0x0F, 0x11, 0x12,
-    0x13, 0x14, 0x15, 0x16, 0x17, 0x19, 0x1A, 0x1B,
-    0x1C, 0x1D, 0x1E, 0x1F, 0x04, 0x0C, 0x14, 0x1C
-  };
-
-  auto block_pos = pos >> 4;
-  const auto block_epos = block_pos + (n >> 4);
-  char *p = buf;
-  unsigned int *dwp = reinterpret_cast<unsigned int *>(buf);
-  const int i = pos & 0xf;  // always 0
-  while (block_pos < block_epos) {
-    const char p_i = p[i];
-    for (int j = 0; j < 0x10; ++j) {
-      if (j != i) { p[j] ^= p_i; }
-    }
-    const char roll1 = rotate_table[(block_pos + 0x00) & 0x1f];
-    const char roll2 = rotate_table[(block_pos + 0x0c) & 0x1f];
-    dwp[0] = rotr(rotr(key_[0], roll1) ^ dwp[0], roll2);
-    const char roll3 = rotate_table[(block_pos + 0x03) & 0x1f];
-    const char roll4 = rotate_table[(block_pos + 0x0f) & 0x1f];
-    dwp[1] = rotl(rotl(key_[1], roll3) ^ dwp[1], roll4);
-    const char roll5 = rotate_table[(block_pos + 0x06) & 0x1f];
-    const char roll6 = rotate_table[(block_pos - 0x0e) & 0x1f];
-    dwp[2] = rotr(rotr(key_[2], roll5) ^ dwp[2], roll6);
-    const char roll7 = rotate_table[(block_pos + 0x09) & 0x1f];
-    const char roll8 = rotate_table[(block_pos - 0x0b) & 0x1f];
-    dwp[3] = rotl(rotl(key_[3], roll7) ^ dwp[3], roll8);
-    p += 16;
-    dwp += 4;
-    ++block_pos;
-  }
+PlainReader::PlainReader(const std::string &filename)
+  : stream_buf_() {
+  stream_buf_.open(filename.c_str());
+  file_size_ = stream_buf_.size();
 }
 
-size_t Reader::Read(off_t offset, size_t length, void *dest) {
-  const auto file_size = GetSize();
-  if (static_cast<size_t>(offset) >= file_size) return 0;
-  std::istream *input_stream = istream();
-  if (input_stream == nullptr) return 0;
-  input_stream->seekg(offset);
-  if (input_stream->rdstate() & std::ios_base::failbit) {
-    std::cerr << "mlib::streambuf: failed to seekg(" << offset << ")." << std::endl;
-    return 0UL;
-  }
-  char *s = static_cast<char *>(dest);
-#if 0
-  std::cerr << "mlib::streambuf: read " << length << " bytes from offset "
-            << offset << "." << std::endl; 
-#endif
-  input_stream->read(s, length);
-  if (input_stream->rdstate() & std::ios_base::failbit) {
-    if ( (input_stream->rdstate() & std::ios_base::eofbit) == 0 ) {
-      std::cerr << "mlib::streambuf: failed to read." << std::endl;
-      return 0;
-    } else {
-      const size_t read_bytes = file_size - offset;
-#if 0
-      std::cerr << "mlib::streambuf: reach EOF (read "
-                << read_bytes << " bytes)." << std::endl;
-#endif
-      return read_bytes;
-    }
+size_t PlainReader::GetSize() const {
+  return file_size_;
+}
+
+size_t PlainReader::Read(off_t offset, size_t length, void *dest) {
+  return stream_buf_.readat(offset, static_cast<char *>(dest), length);
+}
+
+MappedReader::MappedReader(const std::string &filename)
+  : data_(nullptr), file_size_(0) {
+  int fd = ::open(filename.c_str(), O_RDONLY);
+  if (fd == -1) return;
+  struct stat st;
+  if (::fstat(fd, &st) == -1 || !S_ISREG(st.st_mode) || st.st_size == 0) {
+    ::close(fd);
+    return;
   }
-  const size_t read_bytes = input_stream->tellg() - offset;
-#if 0
-  std::cerr << "mlib::streambuf: read " << read_bytes << " bytes successfully." << std::endl;
-#endif
-  return read_bytes;
+  void *addr = ::mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  // the mapping remains valid after the descriptor is closed
+  ::close(fd);
+  Stats::GetInstance().Add(Stats::kSyscalls, 4);
+  if (addr == MAP_FAILED) return;
+  data_ = static_cast<const char *>(addr);
+  file_size_ = st.st_size;
 }
 
-PlainReader::PlainReader(const std::string &filename)
-  : input_stream_(filename) {
-  if (input_stream_.is_open() == false) {
-    file_size_ = 0;
-  } else {
-    input_stream_.seekg(0, std::ios_base::end);
-    file_size_ = input_stream_.tellg();
-    input_stream_.seekg(0, std::ios_base::beg);
+MappedReader::~MappedReader() {
+  if (data_) {
+    ::munmap(const_cast<char *>(data_), file_size_);
   }
 }
 
-size_t PlainReader::GetSize() const {
+size_t MappedReader::GetSize() const {
   return file_size_;
 }
 
-std::istream *PlainReader::istream() {
-  return &input_stream_;
+size_t MappedReader::Read(off_t offset, size_t length, void *dest) {
+  if (data_ == nullptr || static_cast<size_t>(offset) >= file_size_) return 0;
+  length = std::min(length, file_size_ - offset);
+  ::memcpy(dest, data_ + offset, length);
+  Stats::GetInstance().Add(Stats::kBytesRead, length);
+  return length;
+}
+
+const char *MappedReader::GetView(off_t offset, size_t length) const {
+  if (data_ == nullptr || offset < 0) return nullptr;
+  if (static_cast<size_t>(offset) > file_size_ ||
+      file_size_ - offset < length) {
+    return nullptr;
+  }
+  return data_ + offset;
 }
 
 CamelliaDecrypter::CamelliaDecrypter(const std::string &filename, const unsigned char key_string[16])
-  : stream_buf_(key_string), input_stream_(&stream_buf_) {
+  : stream_buf_(key_string) {
   stream_buf_.open(filename.c_str());
   file_size_ = stream_buf_.size();
-  input_stream_.rdbuf(&stream_buf_);
 }
 
 size_t CamelliaDecrypter::GetSize() const {
   return file_size_;
 }
 
-std::istream *CamelliaDecrypter::istream() {
-  return &input_stream_;
+size_t CamelliaDecrypter::Read(off_t offset, size_t length, void *dest) {
+  return stream_buf_.readat(offset, static_cast<char *>(dest), length);
 }
 
 SecondCryptoDecrypter::SecondCryptoDecrypter(const std::string &filename,
                                              const unsigned char key_string[16])
-  : stream_buf_(key_string), input_stream_(&stream_buf_) {
+  : stream_buf_(key_string) {
   stream_buf_.open(filename.c_str());
   file_size_ = stream_buf_.size();
-  input_stream_.rdbuf(&stream_buf_);
 }
 
 size_t SecondCryptoDecrypter::GetSize() const {
   return file_size_;
 }
 
-std::istream *SecondCryptoDecrypter::istream() {
-  return &input_stream_;
+size_t SecondCryptoDecrypter::Read(off_t offset, size_t length, void *dest) {
+  return stream_buf_.readat(offset, static_cast<char *>(dest), length);
+}
+
+CamelliaEncrypter::CamelliaEncrypter(const unsigned char key_string[16]) {
+  Camellia_Ekeygen(128, key_string, key_table_);
+}
+
+void CamelliaEncrypter::Encode(off_t pos, char *buf, size_t n) const {
+  assert(pos % 16 == 0);
+  assert(n % 16 == 0);
+  // the inverse of camelliabuf::rewrite_buffer()
+  unsigned char *text = reinterpret_cast<unsigned char *>(buf);
+  unsigned int *p = reinterpret_cast<unsigned int *>(buf);
+  int roll_bits = ((pos >> 4) & 0x0f) | 0x10;
+  for (size_t i = 0; i < n; i += 16) {
+    Camellia_EncryptBlock(128, text + i, key_table_, text + i);
+    p[0] = rotr(p[0], roll_bits);
+    p[1] = rotl(p[1], roll_bits);
+    p[2] = rotr(p[2], roll_bits);
+    p[3] = rotl(p[3], roll_bits);
+    p += 4;
+    roll_bits = ((roll_bits + 1) & 0x0f) | 0x10;
+  }
+}
+
+SecondCryptoEncrypter::SecondCryptoEncrypter(const unsigned char key_string[16]) {
+  Crypto2_Ekeygen(key_string, &key_table_);
+}
+
+void SecondCryptoEncrypter::Encode(off_t pos, char *buf, size_t n) const {
+  assert(pos % 16 == 0);
+  assert(n % 16 == 0);
+  Crypto2_EncryptBlocks(key_table_, pos >> 4,
+                        reinterpret_cast<unsigned char *>(buf), n >> 4);
 }
 
 } // namespace mlib
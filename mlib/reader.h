@@ -19,27 +19,65 @@
  */
 
 #include <stdint.h>
+#include <atomic>
+#include <cstring>
+#include <ios>
 #include <string>
+#include "block_cache.h"
 #include "camellia.h"
+#include "crypto2.h"
 
 namespace mlib {
 
 // Interface
+//
+// Read() and GetView() of the readers in this file are
+// positional: each call is independent of the others and does not use
+// the file position of the kernel, so one reader can be shared by many
+// threads without a lock. The verbose flag is process-wide and atomic.
 class Reader {
 public:
   virtual ~Reader() = default;
-  bool IsVerbose() const { return verbose_; }
-  void Verbose(bool verbose = true) { verbose_ = verbose; }
+  bool IsVerbose() const { return verbose_.load(std::memory_order_relaxed); }
+  void Verbose(bool verbose = true) { verbose_.store(verbose, std::memory_order_relaxed); }
 
   virtual size_t GetSize() const = 0;
-  virtual size_t Read(off_t offset, size_t length, void *dest);  
+  /**
+   * @brief Read the file contents into the given buffer.
+   *        Reads shorter than 4096 bytes are served block by block through
+   *        the process-wide BlockCache. Longer reads pread(2) the whole span
+   *        into the buffer and decode it in place, bypassing the cache.
+   * @return the read size.
+   */
+  virtual size_t Read(off_t offset, size_t length, void *dest) = 0;
+
+  /**
+   * @brief Returns a pointer to the file contents without copying.
+   * @param[in] offset an offset from the beginning of the file.
+   * @param[in] length the length of the required range.
+   * @return a pointer to the read-only contents at the given offset
+   *         if this reader can serve the whole range in place,
+   *         and a null pointer otherwise (e.g. an encrypted file).
+   */
+  virtual const char *GetView(off_t, size_t) const { return nullptr; }
+
+  /**
+   * @brief Returns the file descriptor of the raw data for asynchronous I/O.
+   * @return a file descriptor, or -1 if the raw data cannot be read by it.
+   * @note The raw data read from it must be passed to Decode(), and both the
+   *       offset and the length must be multiples of GetBlockSize().
+   */
+  virtual int GetFileDescriptor() const { return -1; }
+  virtual size_t GetBlockSize() const { return 1; }
+  virtual void Decode(off_t /*offset*/, char * /*buf*/, size_t /*length*/) {}
 
 protected:
-  virtual std::istream *istream() = 0;
-  static bool verbose_;
+  static std::atomic<bool> verbose_;
 };
 
-class streambuf_base : public std::streambuf {
+// A file which is read and decoded at positions. The name is a remnant of
+// the std::streambuf it was.
+class streambuf_base {
 public:
   streambuf_base();
   virtual ~streambuf_base();
@@ -49,30 +87,49 @@ public:
   streambuf_base *close();
 
   size_t size() const;
+  int fd() const { return fd_; }
+
+  // decode n bytes at pos which have been read from fd()
+  void decode(off_t pos, char *buf, std::streamsize n) {
+    rewrite_buffer(pos, buf, n);
+  }
+
+  // read and decode n bytes at pos.
+  // this is reentrant, and large reads bypass the block cache.
+  std::streamsize readat(off_t pos, char *s, std::streamsize n);
 
 protected:
-  streambuf_base *setbuf(char *s, std::streamsize n) override;
-  std::streampos seekoff(std::streamoff off, std::ios_base::seekdir way,
-                         std::ios_base::openmode which) override;
-  std::streampos seekpos(std::streampos pos, std::ios_base::openmode which) override;
-  std::streamsize xsgetn(char *s, std::streamsize n) override;
-  int underflow() override;
-  int uflow() override;
-  int overflow(int c) override;
+  // set bytes which identify how this file is decoded in the block cache
+  void set_cache_tag(const void *tag, size_t length);
   virtual void rewrite_buffer(off_t pos, char *buf, std::streamsize n) = 0;
 private:
-  off_t calculate_pos();
+  streambuf_base(const streambuf_base &) = delete;
+  streambuf_base &operator=(const streambuf_base &) = delete;
+
+  std::streamsize load_block(off_t block_pos, char *buf);
+  std::streamsize readat_direct(off_t pos, char *s, std::streamsize n);
 
   static const unsigned int kBufferSize = 4096;
-  char buf_[kBufferSize];
   int fd_;
   size_t file_size_;
+  BlockCache::FileIdentityPtr file_id_;  // a key of decoded blocks in BlockCache
+  std::string cache_tag_;
+};
+
+class plainbuf : public streambuf_base {
+public:
+  plainbuf() : streambuf_base() {
+    set_cache_tag("plain", 5);
+  }
+protected:
+  void rewrite_buffer(off_t, char *, std::streamsize) override {}
 };
 
 class camelliabuf : public streambuf_base {
 public:
   camelliabuf(const unsigned char key_string[16]) : streambuf_base() {
     Camellia_Ekeygen(128, key_string, key_table_);
+    set_cache_tag(key_table_, sizeof(key_table_));
   }
 protected:
   void rewrite_buffer(off_t pos, char *buf, std::streamsize n) override;
@@ -83,22 +140,37 @@ private:
 class crypto2buf : public streambuf_base {
 public:
   crypto2buf(const unsigned char key_string[16]) : streambuf_base() {
-    ::memcpy(key_, key_string, 16);
+    Crypto2_Ekeygen(key_string, &key_table_);
+    set_cache_tag(key_table_.key, sizeof(key_table_.key));
   }
 protected:
   void rewrite_buffer(off_t pos, char *buf, std::streamsize n) override;
 private:
-  unsigned int key_[4];
+  Crypto2KeyTable key_table_;
 };
 
 class PlainReader : public Reader {
 public:
   PlainReader(const std::string &filename);
   size_t GetSize() const override;
-protected:
-  std::istream *istream() override;
+  size_t Read(off_t offset, size_t length, void *dest) override;
+  int GetFileDescriptor() const override { return stream_buf_.fd(); }
+private:
+  plainbuf stream_buf_;
+  size_t file_size_;
+};
+
+// A zero-copy reader of an unencrypted file backed by mmap(2).
+class MappedReader : public Reader {
+public:
+  MappedReader(const std::string &filename);
+  ~MappedReader();
+  bool IsOpen() const { return data_ != nullptr; }
+  size_t GetSize() const override;
+  size_t Read(off_t offset, size_t length, void *dest) override;
+  const char *GetView(off_t offset, size_t length) const override;
 private:
-  std::ifstream input_stream_;
+  const char *data_;
   size_t file_size_;
 };
 
@@ -108,11 +180,14 @@ public:
   // static bool LoadKeyInfo(const std::string &csv);
   // static void PrintKeyTable(const KEY_TABLE_TYPE key_table);
   size_t GetSize() const override;
-protected:
-  std::istream *istream() override;
+  size_t Read(off_t offset, size_t length, void *dest) override;
+  int GetFileDescriptor() const override { return stream_buf_.fd(); }
+  size_t GetBlockSize() const override { return 16; }
+  void Decode(off_t offset, char *buf, size_t length) override {
+    stream_buf_.decode(offset, buf, length);
+  }
 private:
   camelliabuf stream_buf_;
-  std::istream input_stream_;
   size_t file_size_;
 };
 
@@ -121,12 +196,44 @@ public:
   SecondCryptoDecrypter(const std::string &filename, const unsigned char key_string[16]);
   // static bool LoadKeyInfo(const std::string &csv);
   size_t GetSize() const override;
-protected:
-  std::istream *istream() override;
+  size_t Read(off_t offset, size_t length, void *dest) override;
+  int GetFileDescriptor() const override { return stream_buf_.fd(); }
+  size_t GetBlockSize() const override { return 16; }
+  void Decode(off_t offset, char *buf, size_t length) override {
+    stream_buf_.decode(offset, buf, length);
+  }
 private:
   crypto2buf stream_buf_;
-  std::istream input_stream_;
   size_t file_size_;
 };
 
+// Decode n bytes at pos in place with the key table of camelliabuf, as a
+// CamelliaDecrypter does but without a file or statistics. Both must be
+// multiples of 16.
+void CamelliaDecode(const KEY_TABLE_TYPE key_table, off_t pos, char *buf, size_t n);
+
+// The inverse of the decoders above, used to create archives.
+class Encrypter {
+public:
+  virtual ~Encrypter() = default;
+  // encode n bytes at pos in place. both must be multiples of 16.
+  virtual void Encode(off_t pos, char *buf, size_t n) const = 0;
+};
+
+class CamelliaEncrypter : public Encrypter {
+public:
+  CamelliaEncrypter(const unsigned char key_string[16]);
+  void Encode(off_t pos, char *buf, size_t n) const override;
+private:
+  KEY_TABLE_TYPE key_table_;
+};
+
+class SecondCryptoEncrypter : public Encrypter {
+public:
+  SecondCryptoEncrypter(const unsigned char key_string[16]);
+  void Encode(off_t pos, char *buf, size_t n) const override;
+private:
+  Crypto2KeyTable key_table_;
+};
+
 } // namespace mlib
\ No newline at end of file
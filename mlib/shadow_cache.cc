@@ -0,0 +1,157 @@
+/* shadow_cache.cc (updated on 2018/05/10)
+ * Copyright (C) 2018 renny1398.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ */
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <climits>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <algorithm>
+#include <iostream>
+#include <sstream>
+#include <iomanip>
+#include <thread>
+#include <vector>
+#include "fnv1a.h"
+#include "reader.h"
+#include "shadow_cache.h"
+
+namespace {
+
+// increase this when the layout of copies changes
+const unsigned int kFormatVersion = 1;
+const size_t kChunkSize = 4 * 1024 * 1024;
+
+} // namespace
+
+namespace mlib {
+
+const char *const ShadowCache::kEnvironmentVariable = "MLIB_CACHE_DIR";
+
+ShadowCache::ShadowCache() {
+  const char *dir = ::getenv(kEnvironmentVariable);
+  if (dir != nullptr) {
+    SetDirectory(dir);
+  }
+}
+
+ShadowCache &ShadowCache::GetInstance() {
+  static ShadowCache instance;
+  return instance;
+}
+
+void ShadowCache::SetDirectory(const std::string &dir) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  dir_ = dir;
+  while (dir_.size() > 1 && dir_.back() == '/') {
+    dir_.pop_back();
+  }
+}
+
+std::string ShadowCache::GetDirectory() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return dir_;
+}
+
+bool ShadowCache::IsEnabled() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return !dir_.empty();
+}
+
+Reader *ShadowCache::Open(const std::string &filename, int cipher_type,
+                          const unsigned char key_string[16], Reader *decrypter) {
+  const std::string dir = GetDirectory();
+  if (dir.empty() || decrypter == nullptr) return nullptr;
+  char real_path[PATH_MAX];
+  struct stat st;
+  if (::realpath(filename.c_str(), real_path) == nullptr ||
+      ::stat(real_path, &st) != 0) {
+    return nullptr;
+  }
+  uint64_t h = kFnv1aOffsetBasis;
+  h = Fnv1a(h, &kFormatVersion, sizeof(kFormatVersion));
+  h = Fnv1a(h, real_path, ::strlen(real_path));
+  const int64_t size = st.st_size;
+  const int64_t mtime[2] = { st.st_mtim.tv_sec, st.st_mtim.tv_nsec };
+  h = Fnv1a(h, &size, sizeof(size));
+  h = Fnv1a(h, mtime, sizeof(mtime));
+  h = Fnv1a(h, &cipher_type, sizeof(cipher_type));
+  h = Fnv1a(h, key_string, 16);
+  std::ostringstream oss;
+  oss << dir << '/' << std::hex << std::setw(16) << std::setfill('0') << h << ".dec";
+  const std::string path = oss.str();
+
+  struct stat shadow_st;
+  if (::stat(path.c_str(), &shadow_st) != 0 || shadow_st.st_size != st.st_size) {
+    if (Create(path, decrypter) == false) {
+      return nullptr;
+    }
+  }
+  MappedReader *reader = new MappedReader(path);
+  if (reader->IsOpen() == false || reader->GetSize() != decrypter->GetSize()) {
+    delete reader;
+    return nullptr;
+  }
+  return reader;
+}
+
+bool ShadowCache::Create(const std::string &path, Reader *decrypter) const {
+  // write a temporary file and rename it, so that other processes never
+  // see a partial copy
+  const auto delim_pos = path.find_last_of('/');
+  ::mkdir(path.substr(0, delim_pos).c_str(), 0755);
+  std::ostringstream oss;
+  oss << path << ".tmp." << ::getpid() << '.' << std::this_thread::get_id();
+  const std::string tmp_path = oss.str();
+  int fd = ::open(tmp_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (fd == -1) {
+    std::cerr << "[Error] ShadowCache: failed to create '" << tmp_path << "'." << std::endl;
+    return false;
+  }
+  std::cout << "[Info] ShadowCache: creating a decrypted copy '" << path << "'." << std::endl;
+  const size_t size = decrypter->GetSize();
+  std::vector<char> buf(std::min(size, kChunkSize));
+  bool ok = true;
+  for (size_t offset = 0; ok && offset < size; offset += kChunkSize) {
+    const size_t length = std::min(kChunkSize, size - offset);
+    if (decrypter->Read(offset, length, &buf[0]) != length) {
+      ok = false;
+      break;
+    }
+    for (size_t written = 0; written < length; ) {
+      const auto ret = ::write(fd, &buf[written], length - written);
+      if (ret <= 0) {
+        ok = false;
+        break;
+      }
+      written += ret;
+    }
+  }
+  ok = (::close(fd) == 0) && ok;
+  if (ok && ::rename(tmp_path.c_str(), path.c_str()) == 0) {
+    return true;
+  }
+  std::cerr << "[Error] ShadowCache: failed to write '" << path << "'." << std::endl;
+  ::unlink(tmp_path.c_str());
+  return false;
+}
+
+} // namespace mlib
@@ -0,0 +1,76 @@
+#pragma once
+
+/* shadow_cache.h (updated on 2018/05/10)
+ * Copyright (C) 2018 renny1398.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ */
+
+#include <mutex>
+#include <string>
+
+namespace mlib {
+
+class Reader;
+
+////////////////////////////////////////////////////////////////////////
+/// @brief A persistent directory of decrypted copies of archives.
+///
+/// A copy is named after a hash of the archive path, size, mtime, cipher
+/// type and key, so a modified archive never matches an old copy. The
+/// cache is disabled unless a directory is given by SetDirectory() or
+/// the environment variable MLIB_CACHE_DIR.
+////////////////////////////////////////////////////////////////////////
+
+class ShadowCache {
+public:
+  static const char *const kEnvironmentVariable;
+
+  /**
+   * @brief Returns the process-wide cache.
+   */
+  static ShadowCache &GetInstance();
+
+  /**
+   * @brief Set the cache directory. An empty string disables the cache.
+   */
+  void SetDirectory(const std::string &dir);
+  std::string GetDirectory() const;
+  bool IsEnabled() const;
+
+  /**
+   * @brief Open the decrypted copy of an encrypted archive.
+   *        The copy is created with the given decrypter if it is missing.
+   * @param[in] filename an encrypted archive filename.
+   * @param[in] cipher_type, key_string how the archive is encrypted.
+   * @param[in] decrypter a reader which decrypts the archive.
+   * @return a pointer to a created reader of the copy if success,
+   *         and a null pointer otherwise.
+   */
+  Reader *Open(const std::string &filename, int cipher_type,
+               const unsigned char key_string[16], Reader *decrypter);
+
+private:
+  ShadowCache();
+  ShadowCache(const ShadowCache &) = delete;
+  ShadowCache &operator=(const ShadowCache &) = delete;
+
+  bool Create(const std::string &path, Reader *decrypter) const;
+
+  mutable std::mutex mutex_;
+  std::string dir_;
+};
+
+} // namespace mlib
@@ -0,0 +1,175 @@
+/* stats.cc (updated on 2018/05/12)
+ * Copyright (C) 2018 renny1398.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ */
+
+#include <algorithm>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <utility>
+#include <vector>
+#include "block_cache.h"
+#include "stats.h"
+
+namespace {
+
+const char *const kCounterNames[mlib::Stats::kCounterCount] = {
+  "syscalls",
+  "bytes_read",
+  "bytes_decrypted",
+  "decrypt_ns",
+  "mlib_reads",
+  "mlib_seeks",
+  "path_cache_hits",
+  "path_cache_misses",
+};
+
+std::string escape_json(const std::string &s) {
+  std::ostringstream oss;
+  for (const char c : s) {
+    switch (c) {
+    case '"':  oss << "\\\""; break;
+    case '\\': oss << "\\\\"; break;
+    case '\n': oss << "\\n"; break;
+    case '\r': oss << "\\r"; break;
+    case '\t': oss << "\\t"; break;
+    default:
+      if (static_cast<unsigned char>(c) < 0x20) {
+        oss << "\\u" << std::hex << std::setw(4) << std::setfill('0')
+            << static_cast<int>(c) << std::dec;
+      } else {
+        oss << c;
+      }
+    }
+  }
+  return oss.str();
+}
+
+} // namespace
+
+namespace mlib {
+
+Stats::Stats() : enabled_(false), format_(kFormatText) {
+  for (auto &c : counters_) {
+    c.store(0, std::memory_order_relaxed);
+  }
+}
+
+Stats &Stats::GetInstance() {
+  static Stats instance;
+  return instance;
+}
+
+void Stats::AddSeek(const std::string &entry) {
+  if (!IsEnabled()) return;
+  Add(kMLibSeeks);
+  std::lock_guard<std::mutex> lock(mutex_);
+  ++seeks_[entry];
+}
+
+void Stats::Reset() {
+  for (auto &c : counters_) {
+    c.store(0, std::memory_order_relaxed);
+  }
+  std::lock_guard<std::mutex> lock(mutex_);
+  seeks_.clear();
+}
+
+void Stats::Print(std::ostream &os, Format format, size_t max_entries) const {
+  std::vector< std::pair<std::string, uint64_t> > seeks;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    seeks.assign(seeks_.begin(), seeks_.end());
+  }
+  std::stable_sort(seeks.begin(), seeks.end(),
+                   [](const std::pair<std::string, uint64_t> &a,
+                      const std::pair<std::string, uint64_t> &b) {
+                     return a.second > b.second;
+                   });
+  if (seeks.size() > max_entries) {
+    seeks.resize(max_entries);
+  }
+  const BlockCache &cache = BlockCache::GetInstance();
+  const uint64_t hits = cache.GetHitCount();
+  const uint64_t misses = cache.GetMissCount();
+
+  if (format == kFormatJSON) {
+    os << "{";
+    for (int i = 0; i < kCounterCount; ++i) {
+      os << '"' << kCounterNames[i] << "\": " << Get(static_cast<Counter>(i)) << ", ";
+    }
+    os << "\"cache_hits\": " << hits << ", \"cache_misses\": " << misses
+       << ", \"seeks_per_entry\": {";
+    for (size_t i = 0; i < seeks.size(); ++i) {
+      if (i != 0) os << ", ";
+      os << '"' << escape_json(seeks[i].first) << "\": " << seeks[i].second;
+    }
+    os << "}}" << std::endl;
+    return;
+  }
+
+  const uint64_t decrypted = Get(kBytesDecrypted);
+  const double decrypt_sec = Get(kDecryptNanoseconds) / 1e9;
+  os << "[Stats] syscalls        : " << Get(kSyscalls) << '\n'
+     << "[Stats] bytes read      : " << Get(kBytesRead) << '\n'
+     << "[Stats] bytes decrypted : " << decrypted << '\n'
+     << "[Stats] decrypt time    : " << decrypt_sec << " sec.";
+  if (decrypt_sec > 0) {
+    os << " (" << decrypted / decrypt_sec / (1024 * 1024) << " MB/s)";
+  }
+  os << '\n'
+     << "[Stats] cache hits      : " << hits << '\n'
+     << "[Stats] cache misses    : " << misses;
+  if (hits + misses > 0) {
+    os << " (hit rate " << 100.0 * hits / (hits + misses) << "%)";
+  }
+  os << '\n'
+     << "[Stats] MLib reads      : " << Get(kMLibReads) << '\n'
+     << "[Stats] MLib seeks      : " << Get(kMLibSeeks) << '\n';
+  const uint64_t path_hits = Get(kPathCacheHits);
+  const uint64_t path_misses = Get(kPathCacheMisses);
+  os << "[Stats] path hits       : " << path_hits << '\n'
+     << "[Stats] path misses     : " << path_misses;
+  if (path_hits + path_misses > 0) {
+    os << " (hit rate " << 100.0 * path_hits / (path_hits + path_misses) << "%)";
+  }
+  os << '\n';
+  for (const auto &s : seeks) {
+    os << "[Stats]   " << std::setw(8) << s.second << "  " << s.first << '\n';
+  }
+  os.flush();
+}
+
+bool Stats::ParseOption(const std::string &arg) {
+  if (arg == "--stats" || arg == "--stats=text") {
+    format_ = kFormatText;
+  } else if (arg == "--stats=json") {
+    format_ = kFormatJSON;
+  } else {
+    return false;
+  }
+  Enable();
+  return true;
+}
+
+void Stats::Report() const {
+  if (IsEnabled()) {
+    Print(std::cerr, format_);
+  }
+}
+
+} // namespace mlib
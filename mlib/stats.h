@@ -0,0 +1,131 @@
+#pragma once
+
+/* stats.h (updated on 2018/05/12)
+ * Copyright (C) 2018 renny1398.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ */
+
+#include <stdint.h>
+#include <atomic>
+#include <chrono>
+#include <map>
+#include <mutex>
+#include <ostream>
+#include <string>
+
+namespace mlib {
+
+////////////////////////////////////////////////////////////////////////
+/// @brief Process-wide I/O statistics of readers and MLib entries.
+///
+/// Nothing is counted until Enable() is called, so the counters cost a
+/// relaxed load of a flag when disabled. The block cache counters are
+/// taken from BlockCache when printed.
+////////////////////////////////////////////////////////////////////////
+
+class Stats {
+public:
+  enum Counter {
+    kSyscalls,            // open, fstat, pread, lseek, mmap, io_uring_enter, ...
+    kBytesRead,           // bytes read from archives
+    kBytesDecrypted,      // bytes passed to rewrite_buffer() of the ciphers
+    kDecryptNanoseconds,  // time spent in rewrite_buffer() of the ciphers
+    kMLibReads,           // MLib::Read() calls
+    kMLibSeeks,           // MLib::Seek() calls which move the position
+    kPathCacheHits,       // paths found in the cache of VersionedEntry::OpenChild()
+    kPathCacheMisses,     // paths resolved in the archive versions
+    kCounterCount
+  };
+
+  enum Format {
+    kFormatText,
+    kFormatJSON
+  };
+
+  // measure the time of a scope into a counter
+  class Timer {
+  public:
+    explicit Timer(Counter counter)
+      : counter_(counter), enabled_(GetInstance().IsEnabled()) {
+      if (enabled_) start_ = std::chrono::steady_clock::now();
+    }
+    ~Timer() {
+      if (enabled_) {
+        const auto elapsed = std::chrono::steady_clock::now() - start_;
+        GetInstance().Add(counter_, std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count());
+      }
+    }
+  private:
+    const Counter counter_;
+    const bool enabled_;
+    std::chrono::steady_clock::time_point start_;
+  };
+
+  /**
+   * @brief Returns the process-wide statistics.
+   */
+  static Stats &GetInstance();
+
+  void Enable(bool b = true) { enabled_.store(b, std::memory_order_relaxed); }
+  bool IsEnabled() const { return enabled_.load(std::memory_order_relaxed); }
+
+  void Add(Counter counter, uint64_t n = 1) {
+    if (IsEnabled()) counters_[counter].fetch_add(n, std::memory_order_relaxed);
+  }
+  uint64_t Get(Counter counter) const {
+    return counters_[counter].load(std::memory_order_relaxed);
+  }
+
+  /**
+   * @brief Count a seek of an MLib entry (kMLibSeeks and the entry).
+   * @param[in] entry the full path of the entry.
+   */
+  void AddSeek(const std::string &entry);
+
+  void Reset();
+
+  /**
+   * @brief Print the statistics.
+   * @param[in] max_entries the count of the most seeked entries to print.
+   */
+  void Print(std::ostream &os, Format format, size_t max_entries = 20) const;
+
+  /**
+   * @brief Parse a command line option "--stats[=text|json]".
+   *        The statistics are enabled if it matches.
+   * @return true if the given argument is the option, and false otherwise.
+   */
+  bool ParseOption(const std::string &arg);
+
+  /**
+   * @brief Print the statistics to the standard error in the format given
+   *        by ParseOption() if enabled.
+   */
+  void Report() const;
+
+private:
+  Stats();
+  Stats(const Stats &) = delete;
+  Stats &operator=(const Stats &) = delete;
+
+  std::atomic<bool> enabled_;
+  std::atomic<uint64_t> counters_[kCounterCount];
+  Format format_;
+  mutable std::mutex mutex_;
+  std::map<std::string, uint64_t> seeks_;
+};
+
+} // namespace mlib
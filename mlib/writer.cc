@@ -0,0 +1,471 @@
+/* writer.cc (updated on 2018/05/16)
+ * Copyright (C) 2018 renny1398.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ */
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <cstdio>
+#include <cstring>
+#include <algorithm>
+#include <atomic>
+#include <codecvt>
+#include <iostream>
+#include <locale>
+#include <stdexcept>
+#include <thread>
+#include "reader.h"
+#include "writer.h"
+
+namespace {
+
+// the unit of reading, encrypting and writing in Write()
+const size_t kChunkSize = 4 * 1024 * 1024;
+// LIBP stores the offsets of file data in this unit
+const size_t kLIBPOffsetUnit = 1024;
+const size_t kLIBHeaderSize = 16;
+const size_t kLIBPEntrySize = 32;
+const unsigned int kLIBPFlagFile = 0x10000;
+
+off_t align_up(off_t pos, size_t alignment) {
+  if (alignment <= 1) return pos;
+  return (pos + alignment - 1) / alignment * alignment;
+}
+
+void put_u32(char *p, unsigned int value) {
+  ::memcpy(p, &value, sizeof(value));
+}
+
+bool fits_u32(off_t value) {
+  return 0 <= value && value <= static_cast<off_t>(0xffffffffU);
+}
+
+std::vector<std::string> split_path(const std::string &path) {
+  std::vector<std::string> names;
+  std::string name;
+  for (const char c : path) {
+    if (c == '/' || c == '\\') {
+      if ( !name.empty() ) names.push_back(name);
+      name.clear();
+    } else {
+      name.append(1, c);
+    }
+  }
+  if ( !name.empty() ) names.push_back(name);
+  return names;
+}
+
+std::string join_path(const std::string &dir, const std::string &name) {
+  return dir.empty() ? name : dir + '/' + name;
+}
+
+} // namespace
+
+namespace mlib {
+
+struct ArchiveWriter::Node {
+  std::string name;
+  bool directory;
+  std::vector< std::unique_ptr<Node> > children;
+  std::string filename;  // the source OS file
+  MLibPtr entry;         // or the source archive entry
+  size_t size;
+  off_t offset;          // the offset in the archive (set by the layout)
+  size_t index;          // LIBP: the first child entry index or the file index
+
+  Node(const std::string &name, bool directory)
+    : name(name), directory(directory), size(0), offset(0), index(0) {}
+
+  std::unique_ptr<Node> *Find(const std::string &child_name) {
+    for (auto &child : children) {
+      if (child->name == child_name) return &child;
+    }
+    return nullptr;
+  }
+};
+
+struct ArchiveWriter::Segment {
+  off_t offset;
+  size_t length;
+  const Node *node;  // a null pointer if headers_[header]
+  size_t header;
+};
+
+ArchiveWriter::ArchiveWriter(const std::string &product, Format format)
+  : format_(format), encrypter_(CreateEncrypter(product)),
+    data_alignment_(GetDataAlignment(product)), alignment_(data_alignment_),
+    jobs_(std::max(1U, std::thread::hardware_concurrency())),
+    root_(new Node(std::string(), true)) {
+  if (alignment_ == 0) alignment_ = 16;
+}
+
+ArchiveWriter::~ArchiveWriter() = default;
+
+void ArchiveWriter::SetAlignment(unsigned int alignment) noexcept {
+  alignment_ = std::max(1U, alignment);
+}
+
+void ArchiveWriter::SetJobs(unsigned int jobs) noexcept {
+  jobs_ = std::max(1U, jobs);
+}
+
+ArchiveWriter::Node *ArchiveWriter::GetNode(const std::string &path, bool create) {
+  Node *node = root_.get();
+  for (const auto &name : split_path(path)) {
+    std::unique_ptr<Node> *child = node->Find(name);
+    if (child == nullptr) {
+      if ( !create ) return nullptr;
+      node->children.emplace_back(new Node(name, true));
+      child = &node->children.back();
+    } else if ( !(*child)->directory ) {
+      if ( !create ) return nullptr;
+      std::cerr << "[Error] ArchiveWriter: '" << path << "' has a file in its path." << std::endl;
+      return nullptr;
+    }
+    node = child->get();
+  }
+  return node;
+}
+
+ArchiveWriter::Node *ArchiveWriter::AddNode(const std::string &path, bool directory) {
+  std::vector<std::string> names = split_path(path);
+  if (names.empty()) {
+    return directory ? root_.get() : nullptr;
+  }
+  const std::string name = names.back();
+  names.pop_back();
+  std::string parent_path;
+  for (const auto &n : names) parent_path = join_path(parent_path, n);
+  Node *parent = GetNode(parent_path, true);
+  if (parent == nullptr) return nullptr;
+  std::unique_ptr<Node> *child = parent->Find(name);
+  if (child == nullptr) {
+    parent->children.emplace_back(new Node(name, directory));
+    return parent->children.back().get();
+  }
+  // merge directories, and replace anything else
+  if ( !directory || !(*child)->directory ) {
+    child->reset(new Node(name, directory));
+  }
+  return child->get();
+}
+
+bool ArchiveWriter::AddFile(const std::string &path, const std::string &filename) {
+  struct stat st;
+  if (::stat(filename.c_str(), &st) != 0 || !S_ISREG(st.st_mode)) {
+    std::cerr << "[Error] ArchiveWriter: '" << filename << "' is not a file." << std::endl;
+    return false;
+  }
+  Node *node = AddNode(path, false);
+  if (node == nullptr) return false;
+  node->filename = filename;
+  node->size = static_cast<size_t>(st.st_size);
+  return true;
+}
+
+bool ArchiveWriter::AddDirectory(const std::string &path, const std::string &dirname) {
+  DIR *dirp = ::opendir(dirname.c_str());
+  if (dirp == nullptr) {
+    std::cerr << "[Error] ArchiveWriter: failed to open '" << dirname << "'." << std::endl;
+    return false;
+  }
+  std::vector<std::string> names;
+  while (const struct dirent *ent = ::readdir(dirp)) {
+    const std::string name(ent->d_name);
+    if (name == "." || name == "..") continue;
+    names.push_back(name);
+  }
+  ::closedir(dirp);
+  std::sort(names.begin(), names.end());
+
+  if (AddNode(path, true) == nullptr) return false;
+  for (const auto &name : names) {
+    const std::string child_filename = dirname + kPathDelim + name;
+    struct stat st;
+    if (::stat(child_filename.c_str(), &st) != 0) continue;
+    bool ret = true;
+    if (S_ISDIR(st.st_mode)) {
+      ret = AddDirectory(join_path(path, name), child_filename);
+    } else if (S_ISREG(st.st_mode)) {
+      ret = AddFile(join_path(path, name), child_filename);
+    }
+    if ( !ret ) return false;
+  }
+  return true;
+}
+
+bool ArchiveWriter::AddEntry(const std::string &path, const MLibPtr &entry) {
+  if (entry == nullptr || !entry->IsOpen()) return false;
+  if (entry->IsFile()) {
+    Node *node = AddNode(path, false);
+    if (node == nullptr) return false;
+    node->entry = entry;
+    node->size = entry->GetSize();
+    return true;
+  }
+  if (AddNode(path, true) == nullptr) return false;
+  for (const auto &child : entry->GetChildren()) {
+    if ( !AddEntry(join_path(path, child->GetName()), child) ) return false;
+  }
+  return true;
+}
+
+bool ArchiveWriter::Remove(const std::string &path) {
+  std::vector<std::string> names = split_path(path);
+  if (names.empty()) return false;
+  const std::string name = names.back();
+  names.pop_back();
+  std::string parent_path;
+  for (const auto &n : names) parent_path = join_path(parent_path, n);
+  Node *parent = GetNode(parent_path, false);
+  if (parent == nullptr) return false;
+  std::unique_ptr<Node> *child = parent->Find(name);
+  if (child == nullptr) return false;
+  parent->children.erase(parent->children.begin() + (child - &parent->children[0]));
+  return true;
+}
+
+bool ArchiveWriter::LayoutLIB(Node *dir, off_t base, std::vector<Segment> *segments) {
+  const bool utf16 = (format_ == kFormatLIBU);
+  const size_t name_size = utf16 ? 66 : 36;
+  const size_t entry_size = utf16 ? 80 : 48;
+  const size_t count = dir->children.size();
+
+  off_t pos = base + kLIBHeaderSize + entry_size * count;
+  for (auto &child : dir->children) {
+    if (child->directory) {
+      if ( !LayoutLIB(child.get(), align_up(pos, 16), segments) ) return false;
+    } else {
+      child->offset = align_up(pos, alignment_);
+      if (child->size != 0) {
+        segments->push_back(Segment{child->offset, child->size, child.get(), 0});
+      }
+    }
+    pos = child->offset + child->size;
+  }
+  dir->offset = base;
+  dir->size = pos - base;
+
+  std::string header(kLIBHeaderSize + entry_size * count, '\0');
+  header.replace(0, 4, utf16 ? "LIBU" : std::string("LIB\0", 4));
+  put_u32(&header[8], count);
+  for (size_t i = 0; i < count; ++i) {
+    const Node &child = *dir->children[i];
+    char *entry = &header[kLIBHeaderSize + entry_size * i];
+    if (utf16) {
+      std::u16string name;
+      try {
+        name = std::wstring_convert<std::codecvt_utf8_utf16<char16_t>, char16_t>().from_bytes(child.name);
+      } catch (const std::range_error &) {
+        std::cerr << "[Error] ArchiveWriter: '" << child.name << "' is not UTF-8." << std::endl;
+        return false;
+      }
+      if (name_size <= name.size() * 2) {
+        std::cerr << "[Error] ArchiveWriter: '" << child.name << "' is too long for LIBU." << std::endl;
+        return false;
+      }
+      ::memcpy(entry, name.data(), name.size() * 2);
+    } else {
+      if (name_size <= child.name.size()) {
+        std::cerr << "[Error] ArchiveWriter: '" << child.name << "' is too long for LIB." << std::endl;
+        return false;
+      }
+      ::memcpy(entry, child.name.data(), child.name.size());
+    }
+    const off_t offset = child.offset - base;
+    if ( !fits_u32(offset) || !fits_u32(child.size) ) {
+      std::cerr << "[Error] ArchiveWriter: '" << child.name << "' is out of the 4 GB range." << std::endl;
+      return false;
+    }
+    // struct LIB_t::LIBENTRY and LIBU_t::LIBUENTRY { name; length; offset; unknown; }
+    const size_t length_pos = utf16 ? 68 : 36;
+    put_u32(entry + length_pos, child.size);
+    put_u32(entry + length_pos + 4, offset);
+  }
+  headers_.push_back(header);
+  segments->push_back(Segment{base, header.size(), nullptr, headers_.size() - 1});
+  return true;
+}
+
+bool ArchiveWriter::LayoutLIBP(std::vector<Segment> *segments) {
+  if (data_alignment_ == 0) {
+    std::cerr << "[Error] ArchiveWriter: LIBP needs the DATA_ALIGNMENT of the product." << std::endl;
+    return false;
+  }
+  // the children of a directory are contiguous entries in breadth-first order
+  std::vector<Node*> entries(1, root_.get());
+  std::vector<Node*> files;
+  for (size_t i = 0; i < entries.size(); ++i) {
+    Node *node = entries[i];
+    if (node->directory) {
+      node->index = entries.size();
+      for (auto &child : node->children) entries.push_back(child.get());
+    } else {
+      node->index = files.size();
+      files.push_back(node);
+    }
+  }
+
+  const size_t table_size = kLIBHeaderSize + kLIBPEntrySize * entries.size() + 4 * files.size();
+  const off_t data_base = align_up(table_size, data_alignment_);
+  const size_t slot_alignment = align_up(std::max<size_t>(alignment_, kLIBPOffsetUnit), kLIBPOffsetUnit);
+  std::string header(table_size, '\0');
+  char *file_offsets = &header[kLIBHeaderSize + kLIBPEntrySize * entries.size()];
+  off_t pos = data_base;
+  for (Node *file : files) {
+    file->offset = data_base + align_up(pos - data_base, slot_alignment);
+    const off_t offset_index = (file->offset - data_base) / kLIBPOffsetUnit;
+    if ( !fits_u32(offset_index) || !fits_u32(file->size) ) {
+      std::cerr << "[Error] ArchiveWriter: '" << file->name << "' is out of range." << std::endl;
+      return false;
+    }
+    put_u32(file_offsets + 4 * file->index, offset_index);
+    if (file->size != 0) {
+      segments->push_back(Segment{file->offset, file->size, file, 0});
+    }
+    pos = file->offset + file->size;
+  }
+  root_->size = pos;
+
+  header.replace(0, 4, "LIBP");
+  put_u32(&header[4], entries.size());
+  put_u32(&header[8], files.size());
+  for (size_t i = 0; i < entries.size(); ++i) {
+    const Node &node = *entries[i];
+    // struct LIBP_t::LIBPENTRY { name[20]; flags; offset_index; length; }
+    char *entry = &header[kLIBHeaderSize + kLIBPEntrySize * i];
+    if (20 <= node.name.size()) {
+      std::cerr << "[Error] ArchiveWriter: '" << node.name << "' is too long for LIBP." << std::endl;
+      return false;
+    }
+    ::memcpy(entry, node.name.data(), node.name.size());
+    put_u32(entry + 20, node.directory ? 0 : kLIBPFlagFile);
+    put_u32(entry + 24, node.index);
+    put_u32(entry + 28, node.directory ? node.children.size() : node.size);
+  }
+  headers_.push_back(header);
+  segments->push_back(Segment{0, header.size(), nullptr, headers_.size() - 1});
+  return true;
+}
+
+bool ArchiveWriter::ReadSegment(const Segment &segment, off_t offset, size_t length, char *dest) const {
+  if (segment.node == nullptr) {
+    ::memcpy(dest, headers_[segment.header].data() + offset, length);
+    return true;
+  }
+  const Node &node = *segment.node;
+  if (node.entry) {
+    if (node.entry->Read(offset, length, dest) == length) return true;
+    std::cerr << "[Error] ArchiveWriter: failed to read '" << node.entry->GetFullPath() << "'." << std::endl;
+    return false;
+  }
+  const int fd = ::open(node.filename.c_str(), O_RDONLY);
+  size_t read_bytes = 0;
+  while (0 <= fd && read_bytes < length) {
+    const ssize_t ret = ::pread(fd, dest + read_bytes, length - read_bytes, offset + read_bytes);
+    if (ret <= 0) break;
+    read_bytes += ret;
+  }
+  if (0 <= fd) ::close(fd);
+  if (read_bytes == length) return true;
+  std::cerr << "[Error] ArchiveWriter: failed to read '" << node.filename << "'." << std::endl;
+  return false;
+}
+
+bool ArchiveWriter::WriteSegments(int fd, const std::vector<Segment> &segments, size_t total_size) const {
+  const size_t chunk_count = (total_size + kChunkSize - 1) / kChunkSize;
+  std::atomic<size_t> next(0);
+  std::atomic<bool> failed(false);
+
+  // every chunk is assembled, encrypted and written independently
+  auto work = [&]() {
+    std::vector<char> buf(kChunkSize);
+    for (size_t c = next++; c < chunk_count && !failed; c = next++) {
+      const off_t begin = static_cast<off_t>(c * kChunkSize);
+      const size_t length = std::min(kChunkSize, total_size - c * kChunkSize);
+      const off_t end = begin + length;
+      std::fill(buf.begin(), buf.begin() + length, 0);
+      auto it = std::upper_bound(segments.cbegin(), segments.cend(), begin,
+                                 [](off_t pos, const Segment &s) { return pos < s.offset; });
+      if (it != segments.cbegin()) --it;
+      for (; it != segments.cend() && it->offset < end; ++it) {
+        const off_t from = std::max(begin, it->offset);
+        const off_t to = std::min(end, static_cast<off_t>(it->offset + it->length));
+        if (to <= from) continue;
+        if ( !ReadSegment(*it, from - it->offset, to - from, &buf[from - begin]) ) {
+          failed = true;
+          break;
+        }
+      }
+      if (failed) break;
+      if (encrypter_) {
+        encrypter_->Encode(begin, &buf[0], length);
+      }
+      size_t written = 0;
+      while (written < length) {
+        const ssize_t ret = ::pwrite(fd, &buf[written], length - written, begin + written);
+        if (ret <= 0) break;
+        written += ret;
+      }
+      if (written < length) {
+        std::cerr << "[Error] ArchiveWriter: failed to write the archive." << std::endl;
+        failed = true;
+      }
+    }
+  };
+
+  const unsigned int thread_count = static_cast<unsigned int>(
+      std::max<size_t>(1, std::min<size_t>(jobs_, chunk_count)));
+  std::vector<std::thread> threads;
+  for (unsigned int i = 1; i < thread_count; ++i) {
+    threads.emplace_back(work);
+  }
+  work();
+  for (auto &t : threads) t.join();
+  return !failed;
+}
+
+bool ArchiveWriter::Write(const std::string &filename) {
+  std::vector<Segment> segments;
+  headers_.clear();
+  const bool ret = (format_ == kFormatLIBP) ?
+      LayoutLIBP(&segments) : LayoutLIB(root_.get(), 0, &segments);
+  if ( !ret ) return false;
+  std::sort(segments.begin(), segments.end(),
+            [](const Segment &a, const Segment &b) { return a.offset < b.offset; });
+  // encrypters work on 16-byte blocks
+  const size_t total_size = encrypter_ ? align_up(root_->size, 16) : root_->size;
+
+  const std::string tmp_filename = filename + ".tmp";
+  const int fd = ::open(tmp_filename.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (fd < 0) {
+    std::cerr << "[Error] ArchiveWriter: failed to create '" << tmp_filename << "'." << std::endl;
+    return false;
+  }
+  bool written = (::ftruncate(fd, total_size) == 0) && WriteSegments(fd, segments, total_size);
+  written = (::close(fd) == 0) && written;
+  if (written && std::rename(tmp_filename.c_str(), filename.c_str()) == 0) {
+    return true;
+  }
+  std::cerr << "[Error] ArchiveWriter: failed to write '" << filename << "'." << std::endl;
+  ::unlink(tmp_filename.c_str());
+  return false;
+}
+
+} // namespace mlib
@@ -0,0 +1,118 @@
+#pragma once
+
+/* writer.h (updated on 2018/05/16)
+ * Copyright (C) 2018 renny1398.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ */
+
+#include <memory>
+#include <string>
+#include <vector>
+#include "mlib.h"
+
+namespace mlib {
+
+class Encrypter;
+
+////////////////////////////////////////////////////////////////////////
+/// @brief ArchiveWriter class
+///
+/// Builds a LIB, LIBU or LIBP archive from OS files and entries of open
+/// archives. Entries added later replace earlier ones with the same path,
+/// so an archive can be repacked with overrides. Nothing is read until
+/// Write(), which lays out the archive, and then reads, encrypts and
+/// writes it in chunks on several threads. A writer itself is used by one
+/// thread at a time.
+////////////////////////////////////////////////////////////////////////
+
+class ArchiveWriter {
+public:
+  enum Format { kFormatLIB, kFormatLIBU, kFormatLIBP };
+
+  /**
+   * @brief A constructor.
+   * @param[in] product a product code name which gives the key and the data alignment.
+   *            The archive is not encrypted if the product is not in the key info.
+   * @param[in] format the archive format to write.
+   */
+  ArchiveWriter(const std::string &product, Format format);
+  ~ArchiveWriter();
+  ArchiveWriter(const ArchiveWriter &) = delete;
+  ArchiveWriter &operator=(const ArchiveWriter &) = delete;
+
+  /**
+   * @brief Set the alignment of file data (default: the product's DATA_ALIGNMENT).
+   * @note LIBP aligns file data to 1 KB at least.
+   */
+  void SetAlignment(unsigned int alignment) noexcept;
+  /**
+   * @brief Set the count of threads to read, encrypt and write (default: the number of CPUs).
+   */
+  void SetJobs(unsigned int jobs) noexcept;
+
+  /**
+   * @brief Add an OS file.
+   * @param[in] path the path of the file in the archive ('/'-separated).
+   * @param[in] filename the OS file to store.
+   * @return true if success, and false otherwise.
+   */
+  bool AddFile(const std::string &path, const std::string &filename);
+  /**
+   * @brief Add an OS directory and its contents recursively.
+   * @param[in] path the path of the directory in the archive. An empty path means the root.
+   * @param[in] dirname the OS directory to store.
+   */
+  bool AddDirectory(const std::string &path, const std::string &dirname);
+  /**
+   * @brief Add an entry of an archive. A directory is added recursively.
+   * @param[in] path the path of the entry in the archive. An empty path means the root.
+   * @param[in] entry a file or directory entry which must be open until Write() returns.
+   */
+  bool AddEntry(const std::string &path, const MLibPtr &entry);
+  /**
+   * @brief Remove an entry which has been added.
+   * @return true if the entry was found, and false otherwise.
+   */
+  bool Remove(const std::string &path);
+
+  /**
+   * @brief Write the archive.
+   * @param[in] filename the archive filename. It is replaced only when the whole archive is written.
+   * @return true if success, and false otherwise.
+   */
+  bool Write(const std::string &filename);
+
+private:
+  struct Node;
+  struct Segment;
+
+  Node *GetNode(const std::string &path, bool create);
+  Node *AddNode(const std::string &path, bool directory);
+  bool LayoutLIB(Node *dir, off_t base, std::vector<Segment> *segments);
+  bool LayoutLIBP(std::vector<Segment> *segments);
+  bool ReadSegment(const Segment &segment, off_t offset, size_t length, char *dest) const;
+  bool WriteSegments(int fd, const std::vector<Segment> &segments, size_t total_size) const;
+
+  const Format format_;
+  std::unique_ptr<Encrypter> encrypter_;
+  unsigned int data_alignment_;
+  unsigned int alignment_;
+  unsigned int jobs_;
+  std::unique_ptr<Node> root_;
+  std::vector<std::string> headers_;
+};
+
+} // namespace mlib
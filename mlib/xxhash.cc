@@ -0,0 +1,131 @@
+/* xxhash.cc (updated on 2018/05/22)
+ * Copyright (C) 2018 renny1398.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ */
+
+#include <cstring>
+#include "xxhash.h"
+
+namespace {
+
+const uint64_t kPrime1 = 0x9E3779B185EBCA87ULL;
+const uint64_t kPrime2 = 0xC2B2AE3D27D4EB4FULL;
+const uint64_t kPrime3 = 0x165667B19E3779F9ULL;
+const uint64_t kPrime4 = 0x85EBCA77C2B2AE63ULL;
+const uint64_t kPrime5 = 0x27D4EB2F165667C5ULL;
+
+inline uint64_t rotl(uint64_t x, int r) {
+  return (x << r) | (x >> (64 - r));
+}
+
+inline uint64_t read64(const unsigned char *p) {
+  uint64_t value;
+  ::memcpy(&value, p, sizeof(value));  // little endian
+  return value;
+}
+
+inline uint32_t read32(const unsigned char *p) {
+  uint32_t value;
+  ::memcpy(&value, p, sizeof(value));
+  return value;
+}
+
+inline uint64_t round(uint64_t acc, uint64_t input) {
+  acc += input * kPrime2;
+  acc = rotl(acc, 31);
+  return acc * kPrime1;
+}
+
+inline uint64_t merge_round(uint64_t acc, uint64_t value) {
+  acc ^= round(0, value);
+  return acc * kPrime1 + kPrime4;
+}
+
+} // namespace
+
+namespace mlib {
+
+XXH64::XXH64(uint64_t seed) noexcept
+  : seed_(seed), acc_{seed + kPrime1 + kPrime2, seed + kPrime2, seed, seed - kPrime1},
+    total_length_(0), buf_size_(0) {}
+
+void XXH64::Update(const void *data, size_t length) noexcept {
+  const unsigned char *p = static_cast<const unsigned char *>(data);
+  const unsigned char *const end = p + length;
+  total_length_ += length;
+  if (buf_size_ + length < sizeof(buf_)) {
+    ::memcpy(buf_ + buf_size_, p, length);
+    buf_size_ += length;
+    return;
+  }
+  if (buf_size_ != 0) {
+    const size_t fill = sizeof(buf_) - buf_size_;
+    ::memcpy(buf_ + buf_size_, p, fill);
+    p += fill;
+    for (int i = 0; i < 4; ++i) {
+      acc_[i] = round(acc_[i], read64(buf_ + i * 8));
+    }
+    buf_size_ = 0;
+  }
+  // stripes of 32 bytes
+  uint64_t v1 = acc_[0], v2 = acc_[1], v3 = acc_[2], v4 = acc_[3];
+  while (end - p >= 32) {
+    v1 = round(v1, read64(p));
+    v2 = round(v2, read64(p + 8));
+    v3 = round(v3, read64(p + 16));
+    v4 = round(v4, read64(p + 24));
+    p += 32;
+  }
+  acc_[0] = v1; acc_[1] = v2; acc_[2] = v3; acc_[3] = v4;
+  buf_size_ = end - p;
+  ::memcpy(buf_, p, buf_size_);
+}
+
+uint64_t XXH64::Digest() const noexcept {
+  uint64_t h;
+  if (total_length_ >= 32) {
+    h = rotl(acc_[0], 1) + rotl(acc_[1], 7) + rotl(acc_[2], 12) + rotl(acc_[3], 18);
+    for (int i = 0; i < 4; ++i) {
+      h = merge_round(h, acc_[i]);
+    }
+  } else {
+    h = seed_ + kPrime5;
+  }
+  h += total_length_;
+  const unsigned char *p = buf_;
+  const unsigned char *const end = buf_ + buf_size_;
+  for (; end - p >= 8; p += 8) {
+    h ^= round(0, read64(p));
+    h = rotl(h, 27) * kPrime1 + kPrime4;
+  }
+  if (end - p >= 4) {
+    h ^= static_cast<uint64_t>(read32(p)) * kPrime1;
+    h = rotl(h, 23) * kPrime2 + kPrime3;
+    p += 4;
+  }
+  for (; p < end; ++p) {
+    h ^= *p * kPrime5;
+    h = rotl(h, 11) * kPrime1;
+  }
+  h ^= h >> 33;
+  h *= kPrime2;
+  h ^= h >> 29;
+  h *= kPrime3;
+  h ^= h >> 32;
+  return h;
+}
+
+} // namespace mlib
@@ -0,0 +1,62 @@
+#pragma once
+
+/* xxhash.h (updated on 2018/05/22)
+ * Copyright (C) 2018 renny1398.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+
+namespace mlib {
+
+////////////////////////////////////////////////////////////////////////
+/// @brief XXH64 class
+///
+/// The 64-bit xxHash of a byte stream, fed in pieces of any size.
+////////////////////////////////////////////////////////////////////////
+
+class XXH64 {
+public:
+  explicit XXH64(uint64_t seed = 0) noexcept;
+
+  /**
+   * @brief Append data to the stream.
+   */
+  void Update(const void *data, size_t length) noexcept;
+  /**
+   * @brief Returns the hash of the data appended so far.
+   */
+  uint64_t Digest() const noexcept;
+
+  /**
+   * @brief Returns the hash of a buffer.
+   */
+  static uint64_t Hash(const void *data, size_t length, uint64_t seed = 0) noexcept {
+    XXH64 state(seed);
+    state.Update(data, length);
+    return state.Digest();
+  }
+
+private:
+  uint64_t seed_;
+  uint64_t acc_[4];
+  uint64_t total_length_;
+  unsigned char buf_[32];  // the bytes which do not fill a stripe yet
+  size_t buf_size_;
+};
+
+} // namespace mlib
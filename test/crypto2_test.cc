@@ -0,0 +1,136 @@
+/* crypto2_test.cc (updated on 2018/05/26)
+ * Copyright (C) 2018 renny1398.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ */
+
+// Check every decryption kernel of crypto2.cc against the reference loop
+// which crypto2buf::rewrite_buffer() used before the kernels.
+
+#include <iostream>
+#include <random>
+#include <vector>
+#include "mlib/crypto2.cc"  // for the kernels in its unnamed namespace
+
+namespace {
+
+void decrypt_reference(const unsigned int key[4], uint64_t block_pos,
+                       unsigned char *buf, size_t block_count) {
+  for (size_t b = 0; b < block_count; ++b, ++block_pos) {
+    unsigned char *p = buf + 16 * b;
+    for (int j = 1; j < 0x10; ++j) {
+      p[j] ^= p[0];
+    }
+    unsigned int dwp[4];
+    ::memcpy(dwp, p, 16);
+    const unsigned char roll1 = rotate_table[(block_pos + 0x00) & 0x1f];
+    const unsigned char roll2 = rotate_table[(block_pos + 0x0c) & 0x1f];
+    dwp[0] = rotr(rotr(key[0], roll1) ^ dwp[0], roll2);
+    const unsigned char roll3 = rotate_table[(block_pos + 0x03) & 0x1f];
+    const unsigned char roll4 = rotate_table[(block_pos + 0x0f) & 0x1f];
+    dwp[1] = rotl(rotl(key[1], roll3) ^ dwp[1], roll4);
+    const unsigned char roll5 = rotate_table[(block_pos + 0x06) & 0x1f];
+    const unsigned char roll6 = rotate_table[(block_pos - 0x0e) & 0x1f];
+    dwp[2] = rotr(rotr(key[2], roll5) ^ dwp[2], roll6);
+    const unsigned char roll7 = rotate_table[(block_pos + 0x09) & 0x1f];
+    const unsigned char roll8 = rotate_table[(block_pos - 0x0b) & 0x1f];
+    dwp[3] = rotl(rotl(key[3], roll7) ^ dwp[3], roll8);
+    ::memcpy(p, dwp, 16);
+  }
+}
+
+struct Kernel {
+  const char *name;
+  DecryptFunc func;
+  bool supported;
+};
+
+std::vector<Kernel> get_kernels() {
+  std::vector<Kernel> kernels;
+  kernels.push_back(Kernel{"scalar", &DecryptBlocksScalar, true});
+#ifdef MLIB_CRYPTO2_X86
+  __builtin_cpu_init();
+  kernels.push_back(Kernel{"sse4.1", &DecryptBlocksSSE41,
+      __builtin_cpu_supports("sse4.1") && __builtin_cpu_supports("ssse3")});
+  kernels.push_back(Kernel{"avx2", &DecryptBlocksAVX2, __builtin_cpu_supports("avx2") != 0});
+#endif
+  return kernels;
+}
+
+} // namespace
+
+int main() {
+  const int kCaseCount = 2000;
+  std::mt19937_64 rng(20180526);
+  const std::vector<Kernel> kernels = get_kernels();
+  int failures = 0;
+
+  for (const auto &kernel : kernels) {
+    if ( !kernel.supported ) {
+      std::cout << "[Info] crypto2_test: skip " << kernel.name << " (not supported)." << std::endl;
+    }
+  }
+
+  for (int n = 0; n < kCaseCount; ++n) {
+    unsigned char key_string[16];
+    for (auto &c : key_string) c = static_cast<unsigned char>(rng());
+    unsigned int key[4];
+    ::memcpy(key, key_string, 16);
+    mlib::Crypto2KeyTable table;
+    mlib::Crypto2_Ekeygen(key_string, &table);
+
+    const uint64_t block_pos = rng() >> 20;
+    const size_t block_count = rng() % 300;
+    std::vector<unsigned char> cipher(block_count * 16 + 1);
+    for (auto &c : cipher) c = static_cast<unsigned char>(rng());
+
+    std::vector<unsigned char> expected(cipher);
+    decrypt_reference(key, block_pos, expected.data(), block_count);
+
+    auto check = [&](const char *name, const std::vector<unsigned char> &actual) {
+      if (actual == expected) return;
+      if (failures++ < 10) {
+        std::cerr << "[Error] crypto2_test: " << name << " differs at block " << block_pos
+                  << " (" << block_count << " blocks)." << std::endl;
+      }
+    };
+
+    for (const auto &kernel : kernels) {
+      if ( !kernel.supported ) continue;
+      std::vector<unsigned char> actual(cipher);
+      kernel.func(table, block_pos & (mlib::Crypto2KeyTable::kPositions - 1),
+                  actual.data(), block_count);
+      check(kernel.name, actual);
+    }
+
+    std::vector<unsigned char> actual(cipher);
+    mlib::Crypto2_DecryptBlocks(table, block_pos, actual.data(), block_count);
+    check("Crypto2_DecryptBlocks", actual);
+
+    // Crypto2_EncryptBlocks() is the inverse
+    mlib::Crypto2_EncryptBlocks(table, block_pos, actual.data(), block_count);
+    if (actual != cipher && failures++ < 10) {
+      std::cerr << "[Error] crypto2_test: Crypto2_EncryptBlocks does not invert at block "
+                << block_pos << "." << std::endl;
+    }
+  }
+
+  if (failures != 0) {
+    std::cerr << "[Error] crypto2_test: " << failures << " failures." << std::endl;
+    return 1;
+  }
+  std::cout << "[Info] crypto2_test: " << kCaseCount << " cases OK." << std::endl;
+  return 0;
+}
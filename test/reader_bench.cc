@@ -0,0 +1,252 @@
+/* reader_bench.cc (updated on 2018/05/14)
+ * Copyright (C) 2018 renny1398.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ */
+
+// Measures the throughput of the readers over synthetic archives.
+//
+// Usage: reader_bench [--dir=DIR] [--sizes=MB,MB,...] [--read-size=BYTES]
+//                     [--format=json|csv] [--no-cache]
+//
+// A plain, a Camellia-128 and a SLT-cipher image of random data are
+// written to DIR for every size and read sequentially, with a stride and
+// at random offsets. The files stay in the page cache, so the results
+// show the cost of the readers rather than of the device.
+
+#include <unistd.h>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+#include "mlib/reader.h"
+#include "mlib/block_cache.h"
+
+namespace {
+
+const unsigned char kKeyString[16] = {
+  0x03, 0x02, 0x01, 0x00, 0x07, 0x06, 0x05, 0x04,
+  0x0b, 0x0a, 0x09, 0x08, 0x0f, 0x0e, 0x0d, 0x0c
+};
+
+enum ReaderType { kPlain, kCamellia, kSecondCrypto, kReaderTypeCount };
+const char *const kReaderNames[kReaderTypeCount] = {
+  "PlainReader", "CamelliaDecrypter", "SecondCryptoDecrypter"
+};
+
+enum Pattern { kSequential, kStrided, kRandom, kPatternCount };
+const char *const kPatternNames[kPatternCount] = {
+  "sequential", "strided", "random"
+};
+
+struct Options {
+  std::string dir;
+  std::vector<size_t> sizes;  // in MB
+  size_t read_size;
+  bool json;
+  bool cache;
+  Options() : dir("."), sizes{1, 16, 128}, read_size(4096), json(true), cache(true) {}
+};
+
+struct Result {
+  ReaderType reader;
+  size_t file_size;
+  Pattern pattern;
+  size_t read_size;
+  size_t bytes;
+  double seconds;
+};
+
+bool parse_options(int argc, char **argv, Options *options) {
+  for (int i = 1; i < argc; ++i) {
+    const std::string arg(argv[i]);
+    if (arg.compare(0, 6, "--dir=") == 0) {
+      options->dir = arg.substr(6);
+    } else if (arg.compare(0, 8, "--sizes=") == 0) {
+      options->sizes.clear();
+      std::istringstream iss(arg.substr(8));
+      std::string token;
+      while (std::getline(iss, token, ',')) {
+        const size_t mb = std::strtoul(token.c_str(), nullptr, 10);
+        if (mb == 0) return false;
+        options->sizes.push_back(mb);
+      }
+    } else if (arg.compare(0, 12, "--read-size=") == 0) {
+      options->read_size = std::strtoul(arg.c_str() + 12, nullptr, 10);
+      if (options->read_size == 0) return false;
+    } else if (arg == "--format=json") {
+      options->json = true;
+    } else if (arg == "--format=csv") {
+      options->json = false;
+    } else if (arg == "--no-cache") {
+      options->cache = false;
+    } else {
+      return false;
+    }
+  }
+  return !options->sizes.empty();
+}
+
+// write a file of size bytes encoded by the given encrypter (or plain)
+bool generate(const std::string &filename, size_t size, const mlib::Encrypter *encrypter) {
+  FILE *fp = std::fopen(filename.c_str(), "wb");
+  if (fp == nullptr) return false;
+  std::mt19937 rng(static_cast<unsigned int>(size));
+  std::vector<char> buf(1024 * 1024);
+  for (size_t offset = 0; offset < size; offset += buf.size()) {
+    const size_t length = std::min(buf.size(), size - offset);
+    for (size_t i = 0; i < length; i += 4) {
+      const unsigned int r = rng();
+      std::memcpy(&buf[i], &r, std::min<size_t>(4, length - i));
+    }
+    if (encrypter) {
+      encrypter->Encode(offset, &buf[0], length & ~static_cast<size_t>(15));
+    }
+    if (std::fwrite(&buf[0], 1, length, fp) != length) {
+      std::fclose(fp);
+      return false;
+    }
+  }
+  return std::fclose(fp) == 0;
+}
+
+mlib::Reader *open_reader(ReaderType type, const std::string &filename) {
+  switch (type) {
+  case kPlain:
+    return new mlib::PlainReader(filename);
+  case kCamellia:
+    return new mlib::CamelliaDecrypter(filename, kKeyString);
+  case kSecondCrypto:
+    return new mlib::SecondCryptoDecrypter(filename, kKeyString);
+  default:
+    return nullptr;
+  }
+}
+
+Result run(mlib::Reader *reader, Pattern pattern, size_t read_size) {
+  Result result;
+  result.file_size = reader->GetSize();
+  result.pattern = pattern;
+  result.read_size = read_size;
+  result.bytes = 0;
+  const size_t file_size = result.file_size;
+  const size_t stride = read_size * 16;
+  const size_t random_count = std::max<size_t>(1, file_size / stride);
+  std::vector<char> buf(read_size);
+  std::mt19937_64 rng(1);
+  const auto start = std::chrono::steady_clock::now();
+  switch (pattern) {
+  case kSequential:
+    for (size_t offset = 0; offset < file_size; offset += read_size) {
+      result.bytes += reader->Read(offset, read_size, &buf[0]);
+    }
+    break;
+  case kStrided:
+    for (size_t offset = 0; offset < file_size; offset += stride) {
+      result.bytes += reader->Read(offset, read_size, &buf[0]);
+    }
+    break;
+  case kRandom:
+    for (size_t i = 0; i < random_count; ++i) {
+      const size_t offset = rng() % (file_size - std::min(file_size, read_size) + 1);
+      result.bytes += reader->Read(offset, read_size, &buf[0]);
+    }
+    break;
+  default:
+    break;
+  }
+  const auto elapsed = std::chrono::steady_clock::now() - start;
+  result.seconds = std::chrono::duration<double>(elapsed).count();
+  return result;
+}
+
+void print(const std::vector<Result> &results, bool json) {
+  if (json) {
+    std::cout << "[\n";
+  } else {
+    std::cout << "reader,file_size,pattern,read_size,bytes,seconds,mb_per_s\n";
+  }
+  for (size_t i = 0; i < results.size(); ++i) {
+    const Result &r = results[i];
+    const double mbps = (r.seconds > 0) ? r.bytes / r.seconds / (1024 * 1024) : 0;
+    if (json) {
+      std::cout << "  {\"reader\": \"" << kReaderNames[r.reader] << "\", "
+                << "\"file_size\": " << r.file_size << ", "
+                << "\"pattern\": \"" << kPatternNames[r.pattern] << "\", "
+                << "\"read_size\": " << r.read_size << ", "
+                << "\"bytes\": " << r.bytes << ", "
+                << "\"seconds\": " << r.seconds << ", "
+                << "\"mb_per_s\": " << mbps << '}'
+                << ((i + 1 < results.size()) ? ",\n" : "\n");
+    } else {
+      std::cout << kReaderNames[r.reader] << ',' << r.file_size << ','
+                << kPatternNames[r.pattern] << ',' << r.read_size << ','
+                << r.bytes << ',' << r.seconds << ',' << mbps << '\n';
+    }
+  }
+  if (json) {
+    std::cout << "]\n";
+  }
+  std::cout.flush();
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+  Options options;
+  if (parse_options(argc, argv, &options) == false) {
+    std::cerr << "Usage: reader_bench [--dir=DIR] [--sizes=MB,MB,...] [--read-size=BYTES]\n"
+              << "                    [--format=json|csv] [--no-cache]" << std::endl;
+    return -1;
+  }
+  mlib::BlockCache &cache = mlib::BlockCache::GetInstance();
+  if (options.cache == false) {
+    cache.SetCapacity(0);
+  }
+
+  const mlib::CamelliaEncrypter camellia(kKeyString);
+  const mlib::SecondCryptoEncrypter second_crypto(kKeyString);
+  const mlib::Encrypter *encrypters[kReaderTypeCount] = { nullptr, &camellia, &second_crypto };
+  const char *const suffixes[kReaderTypeCount] = { "plain", "camellia", "crypto2" };
+
+  std::vector<Result> results;
+  for (const size_t mb : options.sizes) {
+    for (int t = 0; t < kReaderTypeCount; ++t) {
+      std::ostringstream oss;
+      oss << options.dir << "/reader_bench_" << mb << "mb_" << suffixes[t] << ".dat";
+      const std::string filename = oss.str();
+      if (generate(filename, mb * 1024 * 1024, encrypters[t]) == false) {
+        std::cerr << "ERROR: failed to create '" << filename << "'." << std::endl;
+        return -1;
+      }
+      for (int p = 0; p < kPatternCount; ++p) {
+        std::unique_ptr<mlib::Reader> reader(open_reader(static_cast<ReaderType>(t), filename));
+        cache.Clear();
+        Result result = run(reader.get(), static_cast<Pattern>(p), options.read_size);
+        result.reader = static_cast<ReaderType>(t);
+        results.push_back(result);
+      }
+      ::unlink(filename.c_str());
+    }
+  }
+  print(results, options.json);
+  return 0;
+}
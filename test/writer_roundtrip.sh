@@ -0,0 +1,68 @@
+#!/bin/sh
+# writer_roundtrip.sh (updated on 2018/05/26)
+# Copyright (C) 2018 renny1398.
+#
+# This program is free software; you can redistribute it and/or
+# modify it under the terms of the GNU General Public License
+# as published by the Free Software Foundation; either version 2
+# of the License, or (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program; if not, write to the Free Software
+# Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+
+# Round trip of ArchiveWriter: mkmaldat packs a generated tree in every
+# format with both ciphers, exmaldat extracts it, and the result must be
+# the same tree.
+#
+# Usage: writer_roundtrip.sh <mkmaldat> <exmaldat> <key_info.csv>
+
+if [ $# -ne 3 ]; then
+  echo "Usage: $0 <mkmaldat> <exmaldat> <key_info.csv>" >&2
+  exit 2
+fi
+
+work=$(mktemp -d) || exit 2
+trap 'rm -rf "$work"' EXIT
+
+# both tools look for key_info.csv beside the top of the build tree
+mkdir -p "$work/bin/tool"
+ln -s "$1" "$work/bin/tool/mkmaldat"
+ln -s "$2" "$work/bin/exmaldat"
+cp "$3" "$work/bin/key_info.csv"
+
+# sizes around the cipher block (16), the cache block (4096) and the
+# data alignments (1024, 4096), and an empty file
+input="$work/in"
+mkdir -p "$input/sub/deep" "$input/sub/empty_dir"
+: > "$input/empty"
+echo "hello" > "$input/sub/hello.txt"
+for size in 1 15 16 17 1023 1024 4095 4096 4097 100000; do
+  head -c $size /dev/urandom > "$input/r$size.bin"
+done
+head -c 70000 /dev/urandom > "$input/sub/deep/large.bin"
+
+failures=0
+# SCC uses Camellia-128 and SLT the cipher on and after SLT
+for product in SCC SLT; do
+  for format in lib libu libp; do
+    set_dir="$work/${product}_$format"
+    mkdir -p "$set_dir"
+    if ! "$work/bin/tool/mkmaldat" "$product" -f $format "$input" "$set_dir/data.dat" > "$set_dir/log" 2>&1 ||
+       ! "$work/bin/exmaldat" "$product" "$set_dir/data" >> "$set_dir/log" 2>&1 ||
+       ! diff -r "$input" "$set_dir/data" >> "$set_dir/log" 2>&1; then
+      echo "[Error] writer_roundtrip: $product $format failed." >&2
+      cat "$set_dir/log" >&2
+      failures=$((failures + 1))
+    else
+      echo "[Info] writer_roundtrip: $product $format OK."
+    fi
+  done
+done
+
+[ $failures -eq 0 ]
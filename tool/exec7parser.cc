@@ -18,12 +18,21 @@
 
 #include "mlib/exec.h"
 #include "mlib/vmparser.h"
+#include "mlib/stats.h"
 #include <iostream>
 
 int main(int argc, char **argv) {
 
+  // remove "--stats[=text|json]" from the arguments
+  int arg_count = 1;
+  for (int i = 1; i < argc; ++i) {
+    if (mlib::Stats::GetInstance().ParseOption(argv[i])) continue;
+    argv[arg_count++] = argv[i];
+  }
+  argc = arg_count;
+
   if (argc < 2) {
-    std::cout << "Usage: exec7parser <product_name> <exec.dat>" << std::endl;
+    std::cout << "Usage: exec7parser <product_name> <exec.dat> [--stats[=json]]" << std::endl;
     return 0;
   }
 
@@ -62,5 +71,6 @@ int main(int argc, char **argv) {
 #endif
   // parser.ParseScenario(&to_as);
   parser.ParseScenario(&to_xhtml);
+  mlib::Stats::GetInstance().Report();
   return 0;
 }
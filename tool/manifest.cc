@@ -0,0 +1,131 @@
+/* manifest.cc (updated on 2018/05/22)
+ * Copyright (C) 2018 renny1398.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ */
+
+#include "mlib/mlib.h"
+#include "mlib/manifest.h"
+#include "mlib/stats.h"
+#include <cstdlib>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <string>
+
+namespace {
+
+void print_usage() {
+  std::cout << "Usage: manifest <product-name> <input-path> [-jN] [-o output-file]\n"
+            << "       [--changes] [--duplicates]\n\n"
+            << "  Hash every version of every file under input-path (e.g. data) in\n"
+            << "  data.dat to data9.dat, data.lib to data9.lib and the OS directory.\n\n"
+            << "  -j : hash with N threads (default: the number of CPUs)\n"
+            << "  -o : write the manifest to output-file (default: the standard output)\n"
+            << "  --changes : print the files which each archive adds or modifies\n"
+            << "  --duplicates : print the latest files which have the same contents\n"
+            << "  --stats[=json] : print I/O statistics to stderr at exit\n"
+            << std::endl;
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+
+  // remove "--stats[=text|json]" from the arguments
+  int arg_count = 1;
+  for (int i = 1; i < argc; ++i) {
+    if (mlib::Stats::GetInstance().ParseOption(argv[i])) continue;
+    argv[arg_count++] = argv[i];
+  }
+  argc = arg_count;
+
+  if (argc < 3) {
+    print_usage();
+    return 0;
+  }
+
+  const std::string product(argv[1]);
+  const std::string input_path(argv[2]);
+  std::string output;
+  bool changes = false;
+  bool duplicates = false;
+  unsigned int jobs = 0;
+  for (int i = 3; i < argc; ++i) {
+    const std::string p(argv[i]);
+    if (p == "-o") {
+      if (argc <= i + 1) {
+        std::cerr << "ERROR: invalid parameter '" << p << "'." << std::endl;
+        return -1;
+      }
+      output.assign(argv[++i]);
+    } else if (p.compare(0, 2, "-j") == 0) {
+      jobs = std::strtoul(p.c_str() + 2, nullptr, 10);
+    } else if (p == "--changes") {
+      changes = true;
+    } else if (p == "--duplicates") {
+      duplicates = true;
+    } else {
+      print_usage();
+      return -1;
+    }
+  }
+
+  std::string keyinfo_csv(argv[0]);
+  keyinfo_csv.erase(keyinfo_csv.find_last_of(mlib::kPathDelim) + 1);
+  keyinfo_csv.append("..");
+  keyinfo_csv.append(1, mlib::kPathDelim);
+  keyinfo_csv.append("key_info.csv");
+  if (mlib::LoadKeyInfo(keyinfo_csv) == false) {
+    std::cerr << "ERROR: failed to open the key_info file '" << keyinfo_csv << "'." << std::endl;
+    return -1;
+  }
+
+  mlib::VersionedEntry root(input_path, product);
+  if ( !root.IsOpen() ) {
+    std::cerr << "ERROR: failed to open '" << input_path << "'." << std::endl;
+    return -1;
+  }
+  mlib::Manifest manifest;
+  if (jobs != 0) manifest.SetJobs(jobs);
+  const bool ret = manifest.Build(&root);
+
+  if (output.empty()) {
+    manifest.Write(std::cout);
+  } else {
+    std::ofstream ofs(output.c_str());
+    if (ofs.is_open() == false) {
+      std::cerr << "ERROR: failed to create '" << output << "'." << std::endl;
+      return -1;
+    }
+    manifest.Write(ofs);
+  }
+  if (changes) {
+    manifest.PrintChanges(std::cout);
+  }
+  if (duplicates) {
+    for (const auto &group : manifest.GetDuplicates()) {
+      std::cout << "duplicates (size = " << group[0]->size << ", xxh64 = "
+                << std::hex << std::setw(16) << std::setfill('0') << group[0]->hash
+                << std::dec << std::setfill(' ') << "):\n";
+      for (const auto *e : group) {
+        std::cout << "  " << e->path << '\n';
+      }
+    }
+    std::cout.flush();
+  }
+  mlib::Stats::GetInstance().Report();
+  return ret ? 0 : -1;
+}
@@ -0,0 +1,157 @@
+/* mkmaldat.cc (updated on 2018/05/16)
+ * Copyright (C) 2018 renny1398.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ */
+
+#include "mlib/mlib.h"
+#include "mlib/writer.h"
+#include "mlib/stats.h"
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <vector>
+
+namespace {
+
+void print_usage() {
+  std::cout << "Usage: mkmaldat <product-name> [-f lib|libu|libp] [-jN] [-b base-archive]\n"
+            << "       [-i base-product] [-x internal-path] [input-directory] <output-file>\n\n"
+            << "  -f : the archive format (default: the format of base-archive, or lib)\n"
+            << "  -j : write with N threads (default: the number of CPUs)\n"
+            << "  -b : start from the contents of base-archive. files in input-directory\n"
+            << "       replace or are added to them.\n"
+            << "  -i : the product of base-archive (default: product-name)\n"
+            << "  -x : remove internal-path from the archive. it can be repeated.\n"
+            << "  --stats[=json] : print I/O statistics to stderr at exit\n"
+            << std::endl;
+}
+
+bool parse_format(const std::string &name, mlib::ArchiveWriter::Format *format) {
+  if (name == "lib" || name == "LIB") {
+    *format = mlib::ArchiveWriter::kFormatLIB;
+  } else if (name == "libu" || name == "LIBU") {
+    *format = mlib::ArchiveWriter::kFormatLIBU;
+  } else if (name == "libp" || name == "LIBP") {
+    *format = mlib::ArchiveWriter::kFormatLIBP;
+  } else {
+    return false;
+  }
+  return true;
+}
+
+mlib::ArchiveWriter::Format get_format(const mlib::MLibPtr &lib) {
+  if (dynamic_cast<mlib::LIBP_t*>(lib.get())) return mlib::ArchiveWriter::kFormatLIBP;
+  if (dynamic_cast<mlib::LIBU_t*>(lib.get())) return mlib::ArchiveWriter::kFormatLIBU;
+  return mlib::ArchiveWriter::kFormatLIB;
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+
+  // remove "--stats[=text|json]" from the arguments
+  int arg_count = 1;
+  for (int i = 1; i < argc; ++i) {
+    if (mlib::Stats::GetInstance().ParseOption(argv[i])) continue;
+    argv[arg_count++] = argv[i];
+  }
+  argc = arg_count;
+
+  if (argc < 3) {
+    print_usage();
+    return 0;
+  }
+
+  const std::string product(argv[1]);
+  std::string format_name;
+  std::string base_archive;
+  std::string base_product(product);
+  std::vector<std::string> removed_paths;
+  std::vector<std::string> paths;
+  unsigned int jobs = 0;
+  for (int i = 2; i < argc; ++i) {
+    const std::string p(argv[i]);
+    if ((p == "-f" || p == "-b" || p == "-i" || p == "-x") && argc <= i + 1) {
+      std::cerr << "ERROR: invalid parameter '" << p << "'." << std::endl;
+      return -1;
+    }
+    if (p == "-f") {
+      format_name.assign(argv[++i]);
+    } else if (p == "-b") {
+      base_archive.assign(argv[++i]);
+    } else if (p == "-i") {
+      base_product.assign(argv[++i]);
+    } else if (p == "-x") {
+      removed_paths.push_back(argv[++i]);
+    } else if (p.compare(0, 2, "-j") == 0) {
+      jobs = std::strtoul(p.c_str() + 2, nullptr, 10);
+    } else {
+      paths.push_back(p);
+    }
+  }
+  if (paths.empty() || 2 < paths.size() || (paths.size() == 1 && base_archive.empty())) {
+    print_usage();
+    return -1;
+  }
+
+  std::string keyinfo_csv(argv[0]);
+  keyinfo_csv.erase(keyinfo_csv.find_last_of(mlib::kPathDelim) + 1);
+  keyinfo_csv.append("..");
+  keyinfo_csv.append(1, mlib::kPathDelim);
+  keyinfo_csv.append("key_info.csv");
+  if (mlib::LoadKeyInfo(keyinfo_csv) == false) {
+    std::cerr << "ERROR: failed to open the key_info file '" << keyinfo_csv << "'." << std::endl;
+    return -1;
+  }
+
+  mlib::MLibPtr base;
+  mlib::ArchiveWriter::Format format = mlib::ArchiveWriter::kFormatLIB;
+  if ( !base_archive.empty() ) {
+    base = mlib::MLib::Open(base_archive, base_product);
+    if (base == nullptr) {
+      std::cerr << "ERROR: failed to open '" << base_archive << "'." << std::endl;
+      return -1;
+    }
+    format = get_format(base);
+  }
+  if ( !format_name.empty() && !parse_format(format_name, &format) ) {
+    std::cerr << "ERROR: unknown format '" << format_name << "'." << std::endl;
+    return -1;
+  }
+
+  mlib::ArchiveWriter writer(product, format);
+  if (jobs != 0) writer.SetJobs(jobs);
+  if (base && !writer.AddEntry("", base)) {
+    std::cerr << "ERROR: failed to read '" << base_archive << "'." << std::endl;
+    return -1;
+  }
+  if (paths.size() == 2 && !writer.AddDirectory("", paths[0])) {
+    return -1;
+  }
+  for (const auto &path : removed_paths) {
+    if ( !writer.Remove(path) ) {
+      std::cerr << "[Info] '" << path << "' is not in the archive." << std::endl;
+    }
+  }
+  const std::string &output = paths.back();
+  if ( !writer.Write(output) ) {
+    std::cerr << "ERROR: failed to write '" << output << "'." << std::endl;
+    return -1;
+  }
+  std::cout << "OK." << std::endl;
+  mlib::Stats::GetInstance().Report();
+  return 0;
+}
@@ -18,12 +18,21 @@
 
 #include "mlib/exec.h"
 #include "mlib/vmparser.h"
+#include "mlib/stats.h"
 #include <iostream>
 
 int main(int argc, char **argv) {
 
+  // remove "--stats[=text|json]" from the arguments
+  int arg_count = 1;
+  for (int i = 1; i < argc; ++i) {
+    if (mlib::Stats::GetInstance().ParseOption(argv[i])) continue;
+    argv[arg_count++] = argv[i];
+  }
+  argc = arg_count;
+
   if (argc < 2) {
-    std::cout << "Usage: routesim <product_name> <exec.dat>" << std::endl;
+    std::cout << "Usage: routesim <product_name> <exec.dat> [--stats[=json]]" << std::endl;
     return 0;
   }
 
@@ -53,5 +62,6 @@ int main(int argc, char **argv) {
   mlib::Exec exec(&file, argv[1]);
   mlib::VMParser parser(&exec);
   parser.SimulateRoutes();
+  mlib::Stats::GetInstance().Report();
   return 0;
 }